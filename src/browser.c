@@ -0,0 +1,308 @@
+#include "browser.h"
+
+#include <raygui.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BROWSER_CELL_WIDTH 120
+#define BROWSER_CELL_HEIGHT 130
+#define BROWSER_DOUBLE_CLICK 0.4 // seconds
+
+static bool has_suffix(const char* s, const char* suffix) {
+    size_t len = strlen(s);
+    size_t suffix_len = strlen(suffix);
+    return len > suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+static bool is_image_name(const char* name) {
+    return has_suffix(name, ".ppm") || has_suffix(name, ".ppm.gz") || has_suffix(name, ".ppm.zst");
+}
+
+// Parent link first, then directories, then files, each by name
+static int compare_entries(const void* a, const void* b) {
+    const browser_entry_t* x = a;
+    const browser_entry_t* y = b;
+    bool x_up = smatch(x->name, "..");
+    bool y_up = smatch(y->name, "..");
+    if(x_up != y_up) return x_up ? -1 : 1;
+    if(x->is_dir != y->is_dir) return x->is_dir ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static void browser_clear(browser_t* b) {
+    for(int i = 0; i < b->entry_count; i++) {
+        if(b->entries[i].texture.id) UnloadTexture(b->entries[i].texture);
+    }
+    free(b->entries);
+    b->entries = NULL;
+    b->entry_count = 0;
+    b->selected = -1;
+    b->scroll_row = 0;
+
+    // Thumbnails still queued for the old listing would land on the wrong entries
+    if(b->pool_started) thumb_pool_cancel(&b->pool);
+}
+
+static void browser_load_dir(browser_t* b, const char* dir) {
+    char resolved[PATH_MAX];
+    if(!realpath(dir, resolved)) {
+        error("Unable to resolve directory %s", dir);
+        return;
+    }
+
+    DIR* d = opendir(resolved);
+    if(!d) {
+        error("Unable to open directory %s", resolved);
+        return;
+    }
+
+    browser_clear(b);
+    snprintf(b->dir, sizeof(b->dir), "%s", resolved);
+
+    int capacity = 64;
+    b->entries = make(browser_entry_t, capacity);
+    if(!b->entries) {
+        error("Unable to allocate directory listing");
+        closedir(d);
+        return;
+    }
+
+    if(!smatch(resolved, "/")) {
+        b->entries[b->entry_count++] = (browser_entry_t){ .name = "..", .is_dir = true };
+    }
+
+    struct dirent* de;
+    while((de = readdir(d))) {
+        if(de->d_name[0] == '.') continue;
+
+        char full[PATH_MAX + 256];
+        snprintf(full, sizeof(full), "%s/%s", resolved, de->d_name);
+        struct stat st;
+        if(stat(full, &st) != 0) continue;
+
+        bool is_dir = S_ISDIR(st.st_mode);
+        if(!is_dir && !(S_ISREG(st.st_mode) && is_image_name(de->d_name))) continue;
+
+        if(b->entry_count == capacity) {
+            browser_entry_t* grown = realloc(b->entries, sizeof(browser_entry_t) * capacity * 2);
+            if(!grown) {
+                error("Unable to grow directory listing");
+                break;
+            }
+            b->entries = grown;
+            capacity *= 2;
+        }
+
+        browser_entry_t* e = &b->entries[b->entry_count++];
+        *e = (browser_entry_t){ .is_dir = is_dir, .mtime = st.st_mtime, .size = st.st_size };
+        snprintf(e->name, sizeof(e->name), "%s", de->d_name);
+    }
+    closedir(d);
+
+    qsort(b->entries, b->entry_count, sizeof(browser_entry_t), compare_entries);
+}
+
+static void browser_enter(browser_t* b, const char* name) {
+    char next[PATH_MAX + 256];
+    snprintf(next, sizeof(next), "%s/%s", b->dir, name);
+    browser_load_dir(b, next);
+}
+
+// Opens the dialog in the directory of near_path (or where it was last left),
+// prefilling the file name when saving
+void browser_show(browser_t* b, browser_mode_t mode, const char* near_path) {
+    if(!b->pool_started) b->pool_started = thumb_pool_start(&b->pool);
+
+    b->visible = true;
+    b->mode = mode;
+    b->editing_filename = false;
+    b->filename[0] = '\0';
+
+    char dir[PATH_MAX];
+    const char* slash = near_path ? strrchr(near_path, '/') : NULL;
+    if(slash) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - near_path), near_path);
+        if(!dir[0]) snprintf(dir, sizeof(dir), "/");
+        if(mode == BROWSER_SAVE) snprintf(b->filename, sizeof(b->filename), "%s", slash + 1);
+    } else if(b->dir[0]) {
+        snprintf(dir, sizeof(dir), "%s", b->dir);
+    } else if(!getcwd(dir, sizeof(dir))) {
+        snprintf(dir, sizeof(dir), ".");
+    }
+
+    if(mode == BROWSER_SAVE && !b->filename[0]) snprintf(b->filename, sizeof(b->filename), "output.ppm");
+    browser_load_dir(b, dir);
+}
+
+static void browser_collect_thumbs(browser_t* b) {
+    thumb_job_t* job = thumb_pool_collect(&b->pool);
+    while(job) {
+        thumb_job_t* next = job->next;
+        if(job->index < b->entry_count) {
+            browser_entry_t* e = &b->entries[job->index];
+            if(job->ok) {
+                Image img = { job->thumb->pixels, job->thumb->width, job->thumb->height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+                e->texture = LoadTextureFromImage(img);
+                e->thumb = THUMB_READY;
+            } else {
+                e->thumb = THUMB_FAILED;
+            }
+        }
+        thumb_job_free(job);
+        job = next;
+    }
+}
+
+static const char* short_name(const char* name) {
+    if(strlen(name) <= 10) return name;
+    return TextFormat("%.8s..", name);
+}
+
+static void draw_entry(browser_t* b, int i, Rectangle cell) {
+    browser_entry_t* e = &b->entries[i];
+    Rectangle icon = { cell.x + (cell.width - THUMB_SIZE) / 2, cell.y + 4, THUMB_SIZE, THUMB_SIZE };
+
+    if(e->is_dir) {
+        GuiLabel(icon, smatch(e->name, "..") ? "  [up]" : "  [dir]");
+    } else {
+        // Only entries that were on screen get queued, so scrolling sets the order
+        if(e->thumb == THUMB_NONE) {
+            char full[PATH_MAX + 256];
+            snprintf(full, sizeof(full), "%s/%s", b->dir, e->name);
+            thumb_pool_request(&b->pool, full, e->mtime, e->size, i);
+            e->thumb = b->pool_started ? THUMB_PENDING : THUMB_FAILED;
+        }
+
+        if(e->thumb == THUMB_READY) {
+            int longest = e->texture.width > e->texture.height ? e->texture.width : e->texture.height;
+            float scale = (float)THUMB_SIZE / longest;
+            Vector2 pos = {
+                icon.x + (THUMB_SIZE - e->texture.width * scale) / 2,
+                icon.y + (THUMB_SIZE - e->texture.height * scale) / 2,
+            };
+            DrawTextureEx(e->texture, pos, 0.0f, scale, WHITE);
+        } else {
+            GuiLabel(icon, e->thumb == THUMB_PENDING ? "   ..." : "   ?");
+        }
+    }
+
+    GuiLabel((Rectangle) { cell.x + 4, cell.y + THUMB_SIZE + 6, cell.width - 8, 20 }, short_name(e->name));
+    if(i == b->selected) DrawRectangleLinesEx(cell, 2, SKYBLUE);
+}
+
+// Draws the dialog over the window. Returns true once a file was picked,
+// with its full path in path
+bool browser_draw(browser_t* b, int width, int height, char* path, size_t path_size) {
+    if(!b->visible) return false;
+    if(b->pool_started) browser_collect_thumbs(b);
+
+    Rectangle panel = { 40, 40, width - 80, height - 80 };
+    GuiPanel(panel, b->mode == BROWSER_OPEN ? "Open Image" : "Save Image");
+
+    float x = panel.x + 10;
+    float y = panel.y + 34;
+    if(GuiButton((Rectangle) { x, y, 60, 25 }, "Up")) {
+        browser_enter(b, "..");
+        return false;
+    }
+    GuiLabel((Rectangle) { x + 70, y, panel.width - 90, 25 }, b->dir);
+    y += 35;
+
+    Rectangle grid = { x, y, panel.width - 20, panel.height - (y - panel.y) - 50 };
+    int columns = (int)grid.width / BROWSER_CELL_WIDTH;
+    int visible_rows = (int)grid.height / BROWSER_CELL_HEIGHT;
+    if(columns < 1) columns = 1;
+    if(visible_rows < 1) visible_rows = 1;
+    int total_rows = (b->entry_count + columns - 1) / columns;
+
+    // Scroll by whole rows so cells never need clipping
+    if(CheckCollisionPointRec(GetMousePosition(), grid)) {
+        float wheel = GetMouseWheelMove();
+        if(wheel > 0) b->scroll_row--;
+        if(wheel < 0) b->scroll_row++;
+    }
+    int max_scroll = total_rows > visible_rows ? total_rows - visible_rows : 0;
+    if(b->scroll_row > max_scroll) b->scroll_row = max_scroll;
+    if(b->scroll_row < 0) b->scroll_row = 0;
+
+    int clicked = -1;
+    for(int row = b->scroll_row; row < b->scroll_row + visible_rows && row < total_rows; row++) {
+        for(int col = 0; col < columns; col++) {
+            int i = row * columns + col;
+            if(i >= b->entry_count) break;
+
+            Rectangle cell = {
+                grid.x + col * BROWSER_CELL_WIDTH,
+                grid.y + (row - b->scroll_row) * BROWSER_CELL_HEIGHT,
+                BROWSER_CELL_WIDTH - 8,
+                BROWSER_CELL_HEIGHT - 8,
+            };
+            if(GuiButton(cell, "")) clicked = i;
+            draw_entry(b, i, cell);
+        }
+    }
+
+    bool confirm = false;
+    if(clicked >= 0) {
+        browser_entry_t* e = &b->entries[clicked];
+        double now = GetTime();
+        bool double_click = clicked == b->selected && now - b->last_click < BROWSER_DOUBLE_CLICK;
+        b->last_click = now;
+
+        if(e->is_dir) {
+            browser_enter(b, e->name);
+            return false;
+        }
+        b->selected = clicked;
+        snprintf(b->filename, sizeof(b->filename), "%s", e->name);
+        confirm = double_click;
+    }
+
+    float bar_y = panel.y + panel.height - 40;
+    GuiLabel((Rectangle) { x, bar_y, 60, 30 }, "File:");
+    if(GuiTextBox((Rectangle) { x + 60, bar_y, panel.width - 310, 30 }, b->filename, sizeof(b->filename) - 1, b->editing_filename)) {
+        b->editing_filename = !b->editing_filename;
+    }
+    if(GuiButton((Rectangle) { panel.x + panel.width - 230, bar_y, 105, 30 }, b->mode == BROWSER_OPEN ? "Open" : "Save")) {
+        confirm = true;
+    }
+    if(GuiButton((Rectangle) { panel.x + panel.width - 115, bar_y, 105, 30 }, "Cancel")) {
+        b->visible = false;
+        return false;
+    }
+
+    if(!confirm || !b->filename[0]) return false;
+
+    char full[PATH_MAX + 256];
+    if(b->filename[0] == '/') {
+        snprintf(full, sizeof(full), "%s", b->filename);
+    } else {
+        snprintf(full, sizeof(full), "%s/%s", b->dir, b->filename);
+    }
+
+    // A typed directory name navigates instead of picking
+    struct stat st;
+    if(stat(full, &st) == 0 && S_ISDIR(st.st_mode)) {
+        browser_load_dir(b, full);
+        b->filename[0] = '\0';
+        return false;
+    }
+
+    if(strlen(full) >= path_size) {
+        error("Path is too long: %s", full);
+        return false;
+    }
+    snprintf(path, path_size, "%s", full);
+    b->visible = false;
+    return true;
+}
+
+// Textures are GPU objects, call this before the window closes
+void browser_free(browser_t* b) {
+    browser_clear(b);
+    if(b->pool_started) thumb_pool_stop(&b->pool);
+    b->pool_started = false;
+    b->visible = false;
+}
@@ -0,0 +1,52 @@
+#ifndef PRISM_BROWSER_H
+#define PRISM_BROWSER_H
+
+#include <raylib.h>
+
+#include "thumbs.h"
+
+typedef enum browser_mode {
+    BROWSER_OPEN,
+    BROWSER_SAVE,
+} browser_mode_t;
+
+typedef enum thumb_state {
+    THUMB_NONE,
+    THUMB_PENDING,
+    THUMB_READY,
+    THUMB_FAILED,
+} thumb_state_t;
+
+typedef struct browser_entry {
+    char name[256];
+    bool is_dir;
+    long mtime;
+    long size;
+    thumb_state_t thumb;
+    Texture2D texture;
+} browser_entry_t;
+
+// In-app file dialog, thumbnails are requested as entries scroll into view
+// and uploaded as the worker pool finishes them
+typedef struct browser {
+    bool visible;
+    browser_mode_t mode;
+    char dir[PATH_MAX];
+    char filename[256];
+    bool editing_filename;
+
+    browser_entry_t* entries;
+    int entry_count;
+    int selected;
+    int scroll_row;
+    double last_click;
+
+    thumb_pool_t pool;
+    bool pool_started;
+} browser_t;
+
+void browser_show(browser_t* b, browser_mode_t mode, const char* near_path);
+bool browser_draw(browser_t* b, int width, int height, char* path, size_t path_size);
+void browser_free(browser_t* b);
+
+#endif // PRISM_BROWSER_H
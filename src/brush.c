@@ -0,0 +1,277 @@
+// math.h must come before utils.h, which defines a log() macro
+#include <math.h>
+
+#include "brush.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void brush_init(brush_t* brush, int radius) {
+    *brush = (brush_t){ 0 };
+    brush->radius = radius;
+    brush->hardness = 1.0f;
+    brush->opacity = 1.0f;
+    brush->mode = BLEND_NORMAL;
+    brush->mask_radius = -1;
+}
+
+void brush_free(brush_t* brush) {
+    free(brush->mask);
+    free(brush->span_start);
+    free(brush->span_end);
+    brush->mask = NULL;
+    brush->span_start = NULL;
+    brush->span_end = NULL;
+    brush->mask_radius = -1;
+}
+
+void brush_update_mask(brush_t* brush) {
+    if(brush->mask && brush->mask_radius == brush->radius
+        && brush->mask_hardness == brush->hardness && brush->mask_opacity == brush->opacity) {
+        return;
+    }
+
+    brush_free(brush);
+
+    int r = brush->radius < 0 ? 0 : brush->radius;
+    int size = 2 * r + 1;
+    brush->mask = make(unsigned char, size * size);
+    brush->span_start = make(int, size);
+    brush->span_end = make(int, size);
+    if(!brush->mask || !brush->span_start || !brush->span_end) {
+        // brush_stamp only checks mask, so never leave it set without the spans
+        brush_free(brush);
+        error("Unable to allocate brush mask for radius %d", r);
+        return;
+    }
+
+    // Coverage is 1 inside the hard core and eases to 0 at the rim, opacity is
+    // folded in so compositing only needs one multiply per pixel. Fully hard
+    // brushes keep the original dx^2 + dy^2 <= r^2 footprint
+    float rim = r + 0.5f;
+    float core = brush->hardness * rim;
+    bool hard = brush->hardness >= 1.0f;
+    bool binary = true;
+    for(int y = 0; y < size; y++) {
+        int start = size;
+        int end = 0;
+        for(int x = 0; x < size; x++) {
+            int dx = x - r;
+            int dy = y - r;
+            float d = sqrtf((float)(dx * dx + dy * dy));
+
+            float a;
+            if(hard) {
+                a = dx * dx + dy * dy <= r * r ? 1.0f : 0.0f;
+            } else if(d <= core) {
+                a = 1.0f;
+            } else if(d >= rim) {
+                a = 0.0f;
+            } else {
+                float t = (rim - d) / (rim - core);
+                a = t * t * (3.0f - 2.0f * t);
+            }
+
+            unsigned char c = (unsigned char)(a * brush->opacity * 255.0f + 0.5f);
+            brush->mask[y * size + x] = c;
+            if(c != 0 && c != 255) binary = false;
+            if(c) {
+                if(x < start) start = x;
+                end = x + 1;
+            }
+        }
+        brush->span_start[y] = start;
+        brush->span_end[y] = end;
+    }
+
+    brush->mask_radius = r;
+    brush->mask_hardness = brush->hardness;
+    brush->mask_opacity = brush->opacity;
+    brush->mask_binary = binary;
+}
+
+// Rounded x / 255 for x in [0, 65535]
+static inline uint div255(uint x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline unsigned char blend_channel(uint s, uint d, uint cov, blend_mode_t mode) {
+    uint t;
+    switch(mode) {
+        case BLEND_MULTIPLY: t = div255(s * d); break;
+        case BLEND_SCREEN: t = s + d - div255(s * d); break;
+        default: t = s; break;
+    }
+    return (unsigned char)div255(t * cov + d * (255 - cov));
+}
+
+#if defined(__SSE2__)
+static inline __m128i div255_epu16(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i blend_target_epu16(__m128i s, __m128i d, blend_mode_t mode) {
+    switch(mode) {
+        case BLEND_MULTIPLY: return div255_epu16(_mm_mullo_epi16(s, d));
+        case BLEND_SCREEN: return _mm_sub_epi16(_mm_add_epi16(s, d), div255_epu16(_mm_mullo_epi16(s, d)));
+        default: return s;
+    }
+}
+
+static inline __m128i blend_lerp_epu16(__m128i t, __m128i d, __m128i cov) {
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), cov);
+    return div255_epu16(_mm_add_epi16(_mm_mullo_epi16(t, cov), _mm_mullo_epi16(d, inv)));
+}
+#endif
+
+void blend_span(Color* dst, const unsigned char* coverage, int n, Color color, blend_mode_t mode) {
+    int i = 0;
+
+#if defined(__SSE2__)
+    // 4 pixels per iteration, widened to 16-bit lanes for the fixed-point math
+    __m128i zero = _mm_setzero_si128();
+    __m128i src = _mm_setr_epi16(color.r, color.g, color.b, 255, color.r, color.g, color.b, 255);
+    for(; i + 4 <= n; i += 4) {
+        uint cov4;
+        memcpy(&cov4, coverage + i, sizeof(cov4));
+        if(cov4 == 0) continue;
+
+        // c0 c1 c2 c3 -> each coverage repeated across its pixel's 4 channels
+        __m128i c = _mm_cvtsi32_si128((int)cov4);
+        c = _mm_unpacklo_epi8(c, c);
+        c = _mm_unpacklo_epi16(c, c);
+        __m128i c_lo = _mm_unpacklo_epi8(c, zero);
+        __m128i c_hi = _mm_unpackhi_epi8(c, zero);
+
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+        __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+
+        __m128i o_lo = blend_lerp_epu16(blend_target_epu16(src, d_lo, mode), d_lo, c_lo);
+        __m128i o_hi = blend_lerp_epu16(blend_target_epu16(src, d_hi, mode), d_hi, c_hi);
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(o_lo, o_hi));
+    }
+#endif
+
+    for(; i < n; i++) {
+        uint cov = coverage[i];
+        if(cov == 0) continue;
+
+        Color d = dst[i];
+        dst[i] = (Color){
+            blend_channel(color.r, d.r, cov, mode),
+            blend_channel(color.g, d.g, cov, mode),
+            blend_channel(color.b, d.b, cov, mode),
+            blend_channel(255, d.a, cov, mode),
+        };
+    }
+}
+
+// Binary masks on indexed images, covered pixels take the color's index
+static void stamp_indices(ppm_image_t* img, const brush_t* brush, int x, int y, rect_t dirty, uint index) {
+    int r = brush->mask_radius;
+    for(int py = dirty.y; py < dirty.y + dirty.height; py++) {
+        int my = py - (y - r);
+        int px0 = x - r + brush->span_start[my];
+        int px1 = x - r + brush->span_end[my];
+        if(px0 < dirty.x) px0 = dirty.x;
+        if(px1 > dirty.x + dirty.width) px1 = dirty.x + dirty.width;
+
+        ulong row = (ulong)py * img->width;
+        if(img->index8) {
+            if(px1 > px0) memset(img->index8 + row + px0, (int)index, px1 - px0);
+        } else {
+            for(int px = px0; px < px1; px++) {
+                img->index16[row + px] = (ushort)index;
+            }
+        }
+    }
+}
+
+rect_t brush_stamp(ppm_image_t* img, brush_t* brush, int x, int y, Color color) {
+    brush_update_mask(brush);
+    if(!brush->mask) return (rect_t){ 0, 0, 0, 0 };
+
+    int r = brush->mask_radius;
+    int size = 2 * r + 1;
+    rect_t dirty = clip_rect((rect_t){ x - r, y - r, size, size }, img->width, img->height);
+    if(rect_empty(dirty)) return dirty;
+
+    if(ppm_indexed(img)) {
+        int index = brush->mask_binary && brush->mode == BLEND_NORMAL ? ppm_palette_index(img, color) : -1;
+        if(index >= 0) {
+            stamp_indices(img, brush, x, y, dirty, index);
+            return dirty;
+        }
+        if(!ppm_image_expand(img)) return (rect_t){ 0, 0, 0, 0 };
+    }
+
+    for(int py = dirty.y; py < dirty.y + dirty.height; py++) {
+        int my = py - (y - r);
+        int mx0 = brush->span_start[my];
+        int mx1 = brush->span_end[my];
+
+        // Clip the covered part of this mask row against the image
+        int px0 = x - r + mx0;
+        int px1 = x - r + mx1;
+        if(px0 < dirty.x) { mx0 += dirty.x - px0; px0 = dirty.x; }
+        if(px1 > dirty.x + dirty.width) px1 = dirty.x + dirty.width;
+        if(px1 <= px0) continue;
+
+        blend_span(img->pixels + (ulong)py * img->width + px0, brush->mask + my * size + mx0, px1 - px0, color, brush->mode);
+    }
+
+    return dirty;
+}
+
+rect_t brush_stroke(ppm_image_t* img, brush_t* brush, stats_t* stats, int* from_x, int* from_y, int x, int y, Color color) {
+    // Stamp along the segment, spaced so soft stamps overlap without banding.
+    // The start only advances once a stamp lands, so slow drags still paint.
+    // Stats follow each stamp's square, a long diagonal drag would otherwise
+    // rescan the segment's whole bounding box
+    int dx = x - *from_x;
+    int dy = y - *from_y;
+    float length = sqrtf((float)(dx * dx + dy * dy));
+    float spacing = brush->radius * 0.25f;
+    if(spacing < 1.0f) spacing = 1.0f;
+
+    int steps = (int)(length / spacing);
+    rect_t dirty = { 0, 0, 0, 0 };
+    if(steps == 0) return dirty;
+
+    int x0 = *from_x;
+    int y0 = *from_y;
+    for(int i = 1; i <= steps; i++) {
+        float t = (float)i / steps;
+        int sx = x0 + (int)lroundf(dx * t);
+        int sy = y0 + (int)lroundf(dy * t);
+        rect_t bounds = brush_stamp_bounds(img, brush, sx, sy);
+        stats_remove_region(stats, img, bounds);
+        rect_t stamped = brush_stamp(img, brush, sx, sy, color);
+        stats_add_region(stats, img, bounds);
+        dirty = rect_union(dirty, stamped);
+    }
+
+    *from_x = x;
+    *from_y = y;
+    return dirty;
+}
+
+rect_t brush_stamp_bounds(const ppm_image_t* img, const brush_t* brush, int x, int y) {
+    int r = brush->radius < 0 ? 0 : brush->radius;
+    return clip_rect((rect_t){ x - r, y - r, 2 * r + 1, 2 * r + 1 }, img->width, img->height);
+}
+
+const char* blend_mode_name(blend_mode_t mode) {
+    switch(mode) {
+        case BLEND_MULTIPLY: return "Multiply";
+        case BLEND_SCREEN: return "Screen";
+        default: return "Normal";
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef PRISM_BRUSH_H
+#define PRISM_BRUSH_H
+
+#include "image.h"
+#include "stats.h"
+
+typedef enum blend_mode {
+    BLEND_NORMAL,
+    BLEND_MULTIPLY,
+    BLEND_SCREEN,
+    BLEND_MODE_COUNT,
+} blend_mode_t;
+
+// Radius range offered by the brush slider
+#define BRUSH_RADIUS_MIN 1
+#define BRUSH_RADIUS_MAX 50
+
+typedef struct brush {
+    int radius;
+    float hardness; // 0 = fully soft falloff, 1 = hard edge
+    float opacity;  // 0..1, folded into the mask
+    blend_mode_t mode;
+
+    // Coverage mask cache, rebuilt only when radius/hardness/opacity change
+    unsigned char* mask; // (2 * radius + 1)^2 coverage values 0..255
+    int* span_start;     // first covered column of each mask row
+    int* span_end;       // one past the last covered column of each mask row
+    int mask_radius;
+    float mask_hardness;
+    float mask_opacity;
+    bool mask_binary; // every value is 0 or 255, stamps can write palette indices
+} brush_t;
+
+void brush_init(brush_t* brush, int radius);
+void brush_free(brush_t* brush);
+void brush_update_mask(brush_t* brush);
+
+// Hard, opaque normal-mode stamps keep indexed images indexed, anything that
+// blends expands them to direct storage first
+rect_t brush_stamp(ppm_image_t* img, brush_t* brush, int x, int y, Color color);
+rect_t brush_stroke(ppm_image_t* img, brush_t* brush, stats_t* stats, int* from_x, int* from_y, int x, int y, Color color);
+rect_t brush_stamp_bounds(const ppm_image_t* img, const brush_t* brush, int x, int y);
+
+void blend_span(Color* dst, const unsigned char* coverage, int n, Color color, blend_mode_t mode);
+
+const char* blend_mode_name(blend_mode_t mode);
+
+#endif // PRISM_BRUSH_H
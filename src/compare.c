@@ -0,0 +1,325 @@
+// math.h must come before utils.h, which defines a log() macro
+#include <math.h>
+
+#include "compare.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+Color heatmap_color(unsigned char error) {
+    if(error == 0) return (Color){ 0, 0, 0, 0 };
+
+    // Square root ramp from yellow to red so small errors are still visible
+    float t = sqrtf(error / 255.0f);
+    return (Color){ 255, (unsigned char)(255.0f * (1.0f - t)), 0, 220 };
+}
+
+// Per-pixel max channel error for one row, accumulating squared error and max
+static void diff_row(const Color* a, const Color* b, uint n, unsigned char* err, ulong* sum_sq, uint* max_error) {
+    uint i = 0;
+    ulong sq = 0;
+    uint mx = 0;
+
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+    __m128i low = _mm_set1_epi32(0xFF);
+    __m128i acc = _mm_setzero_si128();
+    __m128i vmax = _mm_setzero_si128();
+    for(; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+        // |a - b| per byte, alpha masked off since PPM has none
+        __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        d = _mm_and_si128(d, rgb);
+
+        // Squared channel differences, madd pairs them into 32-bit lanes
+        __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+        __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+        __m128i s = _mm_add_epi32(_mm_madd_epi16(d_lo, d_lo), _mm_madd_epi16(d_hi, d_hi));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(s, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(s, zero));
+
+        // max(r, g, b) lands in the low byte of each pixel
+        __m128i m = _mm_max_epu8(d, _mm_srli_epi32(d, 8));
+        m = _mm_max_epu8(m, _mm_srli_epi32(m, 16));
+        m = _mm_and_si128(m, low);
+        vmax = _mm_max_epu8(vmax, m);
+
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(m, zero), zero);
+        uint e4 = (uint)_mm_cvtsi128_si32(packed);
+        memcpy(err + i, &e4, sizeof(e4));
+    }
+
+    ulong lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sq += lanes[0] + lanes[1];
+
+    unsigned char maxes[16];
+    _mm_storeu_si128((__m128i*)maxes, vmax);
+    for(int k = 0; k < 16; k++) {
+        if(maxes[k] > mx) mx = maxes[k];
+    }
+#endif
+
+    for(; i < n; i++) {
+        int dr = abs((int)a[i].r - b[i].r);
+        int dg = abs((int)a[i].g - b[i].g);
+        int db = abs((int)a[i].b - b[i].b);
+        sq += (ulong)(dr * dr + dg * dg + db * db);
+
+        int m = dr > dg ? dr : dg;
+        m = m > db ? m : db;
+        err[i] = (unsigned char)m;
+        if((uint)m > mx) mx = m;
+    }
+
+    *sum_sq += sq;
+    if(mx > *max_error) *max_error = mx;
+}
+
+// Count errors above tolerance in err[x0, x1) and find the first/last such column
+static uint scan_changed(const unsigned char* err, uint x0, uint x1, unsigned char tolerance, int* first, int* last) {
+    uint count = 0;
+    uint x = x0;
+    *first = -1;
+    *last = -1;
+
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i tol = _mm_set1_epi8((char)tolerance);
+    for(; x + 16 <= x1; x += 16) {
+        __m128i v = _mm_subs_epu8(_mm_loadu_si128((const __m128i*)(err + x)), tol);
+        uint mask = ~(uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xFFFF;
+        if(!mask) continue;
+
+        count += __builtin_popcount(mask);
+        if(*first < 0) *first = x + __builtin_ctz(mask);
+        *last = x + 31 - __builtin_clz(mask);
+    }
+#endif
+
+    for(; x < x1; x++) {
+        if(err[x] <= tolerance) continue;
+        count++;
+        if(*first < 0) *first = x;
+        *last = x;
+    }
+
+    return count;
+}
+
+bool compare_begin(compare_t* c, uint width, uint height, uint tolerance, uint heatmap_rows) {
+    *c = (compare_t){ 0 };
+    c->width = width;
+    c->height = height;
+    c->tolerance = tolerance > 255 ? 255 : tolerance;
+    c->tiles_x = (width + COMPARE_TILE - 1) / COMPARE_TILE;
+    c->tiles_y = (height + COMPARE_TILE - 1) / COMPARE_TILE;
+
+    c->tile_bounds = calloc((size_t)c->tiles_x * c->tiles_y, sizeof(rect_t));
+    c->row_error = make(unsigned char, width);
+    if(!c->tile_bounds || !c->row_error) {
+        error("Unable to allocate comparison buffers for %u x %u", width, height);
+        compare_free(c);
+        return false;
+    }
+
+    if(heatmap_rows) {
+        c->heatmap = alloc_ppm_image(width, heatmap_rows, 255);
+        if(!c->heatmap) {
+            compare_free(c);
+            return false;
+        }
+
+        for(int e = 0; e < 256; e++) {
+            c->heatmap_lut[e] = heatmap_color((unsigned char)e);
+        }
+    }
+
+    return true;
+}
+
+void compare_rows(compare_t* c, const Color* a, const Color* b, uint y, uint count) {
+    for(uint row = 0; row < count; row++) {
+        uint py = y + row;
+        const Color* ra = a + (ulong)row * c->width;
+        const Color* rb = b + (ulong)row * c->width;
+        diff_row(ra, rb, c->width, c->row_error, &c->sum_sq, &c->max_error);
+
+        if(c->heatmap) {
+            Color* out = c->heatmap->pixels + (ulong)(py - c->heatmap_y) * c->width;
+            for(uint x = 0; x < c->width; x++) {
+                out[x] = c->heatmap_lut[c->row_error[x]];
+            }
+        }
+
+        // Grow the tight bounds of every tile this row has changes in
+        rect_t* tiles = c->tile_bounds + (ulong)(py / COMPARE_TILE) * c->tiles_x;
+        for(int tx = 0; tx < c->tiles_x; tx++) {
+            uint x0 = tx * COMPARE_TILE;
+            uint x1 = x0 + COMPARE_TILE < c->width ? x0 + COMPARE_TILE : c->width;
+
+            int first, last;
+            uint changed = scan_changed(c->row_error, x0, x1, (unsigned char)c->tolerance, &first, &last);
+            if(!changed) continue;
+
+            c->changed_pixels += changed;
+            tiles[tx] = rect_union(tiles[tx], (rect_t){ first, py, last - first + 1, 1 });
+        }
+    }
+}
+
+void compare_finish(compare_t* c) {
+    ulong samples = (ulong)c->width * c->height * 3;
+    c->mse = samples ? (double)c->sum_sq / samples : 0.0;
+    c->psnr = c->mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / c->mse) : INFINITY;
+
+    // Group changed tiles into 8-connected regions and merge their bounds
+    int tile_count = c->tiles_x * c->tiles_y;
+    int capacity = 16;
+    bool* visited = calloc(tile_count, sizeof(bool));
+    int* queue = make(int, tile_count);
+    c->regions = make(rect_t, capacity);
+    c->region_count = 0;
+    if(!visited || !queue || !c->regions) {
+        error("Unable to allocate region buffers");
+        free(visited);
+        free(queue);
+        return;
+    }
+
+    for(int start = 0; start < tile_count; start++) {
+        if(visited[start] || rect_empty(c->tile_bounds[start])) continue;
+
+        rect_t bounds = { 0, 0, 0, 0 };
+        int head = 0;
+        int tail = 0;
+        queue[tail++] = start;
+        visited[start] = true;
+
+        while(head < tail) {
+            int t = queue[head++];
+            bounds = rect_union(bounds, c->tile_bounds[t]);
+
+            int tx = t % c->tiles_x;
+            int ty = t / c->tiles_x;
+            for(int ny = ty - 1; ny <= ty + 1; ny++) {
+                for(int nx = tx - 1; nx <= tx + 1; nx++) {
+                    if(nx < 0 || ny < 0 || nx >= c->tiles_x || ny >= c->tiles_y) continue;
+                    int n = ny * c->tiles_x + nx;
+                    if(visited[n] || rect_empty(c->tile_bounds[n])) continue;
+                    visited[n] = true;
+                    queue[tail++] = n;
+                }
+            }
+        }
+
+        if(c->region_count == capacity) {
+            capacity *= 2;
+            rect_t* grown = realloc(c->regions, sizeof(rect_t) * capacity);
+            if(!grown) break;
+            c->regions = grown;
+        }
+        c->regions[c->region_count++] = bounds;
+    }
+
+    free(visited);
+    free(queue);
+}
+
+void compare_free(compare_t* c) {
+    free(c->tile_bounds);
+    free(c->regions);
+    free(c->row_error);
+    free_ppm_image(c->heatmap);
+    *c = (compare_t){ 0 };
+}
+
+bool compare_images(compare_t* c, const ppm_image_t* a, const ppm_image_t* b, uint tolerance, bool heatmap) {
+    if(a->width != b->width || a->height != b->height) {
+        error("Cannot compare %ux%u image with %ux%u image", a->width, a->height, b->width, b->height);
+        return false;
+    }
+
+    if(!compare_begin(c, a->width, a->height, tolerance, heatmap ? a->height : 0)) return false;
+    compare_rows(c, a->pixels, b->pixels, 0, a->height);
+    compare_finish(c);
+    return true;
+}
+
+int compare_files(const char* path_a, const char* path_b, uint tolerance, const char* heatmap_path) {
+    ppm_reader_t ra, rb;
+    if(!ppm_reader_open(&ra, path_a)) return 2;
+    if(!ppm_reader_open(&rb, path_b)) {
+        ppm_reader_close(&ra);
+        return 2;
+    }
+
+    int status = 2;
+    compare_t c = { 0 };
+    ppm_writer_t heatmap = { 0 };
+    Color* band_a = NULL;
+    Color* band_b = NULL;
+
+    if(ra.width != rb.width || ra.height != rb.height) {
+        error("Cannot compare %ux%u image with %ux%u image", ra.width, ra.height, rb.width, rb.height);
+        goto done;
+    }
+
+    // Stream both files in row bands so memory stays bounded regardless of size,
+    // the heatmap only holds one band and is written out as it goes
+    band_a = make(Color, (ulong)ra.width * COMPARE_BAND_ROWS);
+    band_b = make(Color, (ulong)ra.width * COMPARE_BAND_ROWS);
+    if(!band_a || !band_b) {
+        error("Unable to allocate comparison bands");
+        goto done;
+    }
+
+    if(!compare_begin(&c, ra.width, ra.height, tolerance, heatmap_path ? COMPARE_BAND_ROWS : 0)) goto done;
+    if(heatmap_path && !ppm_writer_open(&heatmap, heatmap_path, ra.width, ra.height, 255)) goto done;
+
+    for(uint y = 0; y < ra.height; y += COMPARE_BAND_ROWS) {
+        uint rows = ra.height - y < COMPARE_BAND_ROWS ? ra.height - y : COMPARE_BAND_ROWS;
+        if(!ppm_reader_read_rows(&ra, band_a, rows) || !ppm_reader_read_rows(&rb, band_b, rows)) goto done;
+
+        c.heatmap_y = y;
+        compare_rows(&c, band_a, band_b, y, rows);
+        if(c.heatmap) ppm_writer_write_rows(&heatmap, c.heatmap->pixels, rows);
+    }
+
+    compare_finish(&c);
+
+    printf("size: %ux%u\n", c.width, c.height);
+    printf("changed_pixels: %lu\n", c.changed_pixels);
+    printf("max_error: %u\n", c.max_error);
+    printf("mse: %.6f\n", c.mse);
+    if(isinf(c.psnr)) {
+        printf("psnr: inf\n");
+    } else {
+        printf("psnr: %.3f\n", c.psnr);
+    }
+    printf("regions: %d\n", c.region_count);
+    for(int i = 0; i < c.region_count; i++) {
+        rect_t r = c.regions[i];
+        printf("  %d %d %d %d\n", r.x, r.y, r.width, r.height);
+    }
+
+    status = c.changed_pixels ? 1 : 0;
+
+done:
+    if(heatmap.f && !ppm_writer_close(&heatmap)) {
+        error("Failed to write heatmap: %s", heatmap_path);
+        status = 2;
+    }
+    compare_free(&c);
+    free(band_a);
+    free(band_b);
+    ppm_reader_close(&ra);
+    ppm_reader_close(&rb);
+    return status;
+}
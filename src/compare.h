@@ -0,0 +1,45 @@
+#ifndef PRISM_COMPARE_H
+#define PRISM_COMPARE_H
+
+#include "image.h"
+
+// Changed pixels are binned into tiles of this size to find changed regions
+#define COMPARE_TILE 64
+// Rows per band when comparing files without loading them whole
+#define COMPARE_BAND_ROWS 64
+
+typedef struct compare {
+    uint width;
+    uint height;
+    uint tolerance; // per-channel differences up to this count as unchanged
+
+    ulong changed_pixels;
+    uint max_error;
+    ulong sum_sq; // sum of squared per-channel differences
+    double mse;
+    double psnr;  // INFINITY when the images are identical
+
+    int tiles_x;
+    int tiles_y;
+    rect_t* tile_bounds; // tight bounds of changed pixels in each tile
+
+    rect_t* regions; // bounding boxes of connected changed areas
+    int region_count;
+
+    ppm_image_t* heatmap; // optional, per-pixel error as an overlay color
+    uint heatmap_y;       // image row held in the heatmap's first row
+    Color heatmap_lut[256];
+    unsigned char* row_error; // scratch, max channel error for one row
+} compare_t;
+
+bool compare_begin(compare_t* c, uint width, uint height, uint tolerance, uint heatmap_rows);
+void compare_rows(compare_t* c, const Color* a, const Color* b, uint y, uint count);
+void compare_finish(compare_t* c);
+void compare_free(compare_t* c);
+
+bool compare_images(compare_t* c, const ppm_image_t* a, const ppm_image_t* b, uint tolerance, bool heatmap);
+int compare_files(const char* path_a, const char* path_b, uint tolerance, const char* heatmap_path);
+
+Color heatmap_color(unsigned char error);
+
+#endif // PRISM_COMPARE_H
@@ -0,0 +1,160 @@
+#include "document.h"
+
+#include <string.h>
+
+#define PAGE_BYTES 4096UL
+
+// New empty entry at the end, its index or -1 when all tabs are in use
+int documents_add(documents_t* docs) {
+    if(docs->count == MAX_DOCUMENTS) {
+        error("At most %d documents can be open", MAX_DOCUMENTS);
+        return -1;
+    }
+
+    docs->items[docs->count] = (document_t){ .zoom = 1.0f };
+    return docs->count++;
+}
+
+static void document_free(document_t* doc) {
+    // Pending statistics may still be reading the image
+    stats_free(&doc->stats);
+    free_ppm_image(doc->selection.floating);
+    free_ppm_image(doc->image);
+    compare_free(&doc->compare);
+    *doc = (document_t){ 0 };
+}
+
+// Frees the entry and closes the gap, the active index follows its document
+void documents_remove(documents_t* docs, int index) {
+    if(index < 0 || index >= docs->count) return;
+
+    document_free(&docs->items[index]);
+    memmove(&docs->items[index], &docs->items[index + 1], sizeof(document_t) * (docs->count - index - 1));
+    docs->count--;
+
+    if(docs->active == index) {
+        docs->active = -1;
+    } else if(docs->active > index) {
+        docs->active--;
+    }
+}
+
+// Most recently parked document, the one to go back to after a close
+int documents_recent(const documents_t* docs) {
+    int recent = -1;
+    for(int i = 0; i < docs->count; i++) {
+        if(i == docs->active) continue;
+        if(recent < 0 || docs->items[i].last_used > docs->items[recent].last_used) recent = i;
+    }
+    return recent;
+}
+
+void documents_free(documents_t* docs) {
+    for(int i = 0; i < docs->count; i++) {
+        document_free(&docs->items[i]);
+    }
+    docs->count = 0;
+    docs->active = -1;
+}
+
+// Color counts are calloc'd zero pages, assume each color in use dirtied one
+static ulong stats_bytes(const stats_t* stats) {
+    if(!stats->valid) return 0;
+    ulong counts = stats->unique_colors * PAGE_BYTES;
+    ulong table = (ulong)STATS_COLORS * sizeof(atomic_uint);
+    return sizeof(stats_t) + (counts < table ? counts : table);
+}
+
+static ulong compare_bytes(const compare_t* c) {
+    ulong bytes = (ulong)c->tiles_x * c->tiles_y * sizeof(rect_t) + (ulong)c->region_count * sizeof(rect_t);
+    if(c->row_error) bytes += c->width;
+    if(c->heatmap) bytes += ppm_image_bytes(c->heatmap);
+    return bytes;
+}
+
+// Heap held by all documents, shared images are counted once
+ulong documents_memory(const documents_t* docs) {
+    ulong total = 0;
+    for(int i = 0; i < docs->count; i++) {
+        const document_t* doc = &docs->items[i];
+        bool counted = false;
+        for(int j = 0; j < i && !counted; j++) {
+            counted = docs->items[j].image == doc->image;
+        }
+        if(doc->image && !counted) total += ppm_image_bytes(doc->image);
+        total += stats_bytes(&doc->stats) + compare_bytes(&doc->compare);
+    }
+    return total;
+}
+
+// Inactive documents, least recently used first
+static int documents_lru(const documents_t* docs, int* order) {
+    int n = 0;
+    for(int i = 0; i < docs->count; i++) {
+        if(i == docs->active) continue;
+        int j = n++;
+        while(j > 0 && docs->items[order[j - 1]].last_used > docs->items[i].last_used) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    return n;
+}
+
+// Evicts what inactive documents can rebuild or do without, cheapest to lose
+// first: statistics, then compare heatmaps, then direct pixel storage of
+// low-color images when the user allows palette storage. Images themselves are
+// never dropped, so switching back never goes to disk
+void documents_trim(documents_t* docs) {
+    ulong used = documents_memory(docs);
+    if(used <= docs->budget) {
+        docs->over_budget = false;
+        return;
+    }
+
+    const ppm_image_t* active_image = docs->active >= 0 ? docs->items[docs->active].image : NULL;
+    int order[MAX_DOCUMENTS];
+    int n = documents_lru(docs, order);
+    ulong before = used;
+
+    int stages = docs->may_index ? 3 : 2;
+    for(int stage = 0; stage < stages && used > docs->budget; stage++) {
+        for(int k = 0; k < n && used > docs->budget; k++) {
+            document_t* doc = &docs->items[order[k]];
+            switch(stage) {
+                case 0:
+                    if(!doc->stats.valid) continue;
+                    stats_free(&doc->stats);
+                    break;
+                case 1:
+                    if(!doc->compare.heatmap) continue;
+                    free_ppm_image(doc->compare.heatmap);
+                    doc->compare.heatmap = NULL;
+                    break;
+                case 2:
+                    // The active document would have to expand it again on its next edit, a
+                    // shared image can't change storage under the other documents reading it,
+                    // and neither can one pending statistics are still reading
+                    if(doc->palette_tried || doc->image == active_image || doc->image->refs > 1 || doc->stats.task || ppm_indexed(doc->image)) continue;
+                    doc->palette_tried = true;
+                    if(!ppm_image_index(doc->image)) continue;
+                    break;
+            }
+            used = documents_memory(docs);
+        }
+    }
+
+    if(used < before) log("Trimmed inactive documents from %lu to %lu MB", before >> 20, used >> 20);
+    if(used > docs->budget && !docs->over_budget) {
+        error("Documents use %lu MB, over the %lu MB budget with nothing left to evict", used >> 20, docs->budget >> 20);
+    }
+    docs->over_budget = used > docs->budget;
+}
+
+// Tab label, the file name without its directory
+const char* document_name(const char* filepath) {
+    if(!filepath[0]) return "[Untitled]";
+    const char* slash = strrchr(filepath, '/');
+    return slash ? slash + 1 : filepath;
+}
@@ -0,0 +1,52 @@
+#ifndef PRISM_DOCUMENT_H
+#define PRISM_DOCUMENT_H
+
+#include "image.h"
+#include "selection.h"
+#include "compare.h"
+#include "stats.h"
+
+#define MAX_DOCUMENTS 16
+#define DEFAULT_MEMORY_BUDGET (1024UL << 20) // bytes
+
+// An open image with its view and caches, parked here while another
+// document is active. Duplicates share the image until one of them writes
+typedef struct document {
+    ppm_image_t* image;
+    char filepath[256];
+    float zoom;
+    float pan_x;
+    float pan_y;
+    selection_t selection; // parking commits it, only floating when that failed
+
+    compare_t compare;
+    bool comparing;
+    stats_t stats;
+
+    ulong last_used;    // clock value when it was last parked
+    bool palette_tried; // the budget already tried to index the image
+} document_t;
+
+// Tabs of open documents. The active one is edited in place by the caller
+// and only copied back here, so every entry but that one is current
+typedef struct documents {
+    document_t items[MAX_DOCUMENTS];
+    int count;
+    int active; // -1 while every document is parked
+    ulong clock;
+    ulong budget;     // bytes all documents may use before caches are evicted
+    bool over_budget; // still over after evicting everything possible
+    bool may_index;   // parked images may be switched to palette storage, follows the Indexed toggle
+} documents_t;
+
+int documents_add(documents_t* docs);
+void documents_remove(documents_t* docs, int index);
+int documents_recent(const documents_t* docs);
+void documents_free(documents_t* docs);
+
+ulong documents_memory(const documents_t* docs);
+void documents_trim(documents_t* docs);
+
+const char* document_name(const char* filepath);
+
+#endif // PRISM_DOCUMENT_H
@@ -0,0 +1,655 @@
+#include "image.h"
+#include "stream.h"
+
+#include <string.h>
+
+#define SAVE_BAND_ROWS 64
+
+// Color -> palette index tables are twice the palette's capacity
+#define PALETTE_SLOTS (PALETTE_MAX_COLORS * 2)
+#define PALETTE_SLOTS8 512
+
+static inline uint palette_key(Color c) {
+    return (uint)c.r | ((uint)c.g << 8) | ((uint)c.b << 16) | ((uint)c.a << 24);
+}
+
+static inline uint palette_capacity(const ppm_image_t* img) {
+    return img->index8 ? 256 : PALETTE_MAX_COLORS;
+}
+
+static inline uint palette_slot_count(const ppm_image_t* img) {
+    return img->index8 ? PALETTE_SLOTS8 : PALETTE_SLOTS;
+}
+
+// Multiplicative hash, the top bits pick the slot
+static inline uint palette_slot(uint key, uint slot_count) {
+    return (key * 2654435761u) >> (slot_count == PALETTE_SLOTS8 ? 23 : 15);
+}
+
+ppm_image_t* alloc_ppm_image(uint width, uint height, uint max_color) {
+    if((ulong)width * height > MAX_PIXELS) {
+        error("Image too large: %u * %u > %lu", width, height, MAX_PIXELS);
+        return NULL;
+    }
+
+    ppm_image_t* img = make(ppm_image_t);
+    img->width = width;
+    img->height = height;
+    img->max_color = max_color;
+    img->palette = NULL;
+    img->palette_size = 0;
+    img->index8 = NULL;
+    img->index16 = NULL;
+    img->palette_slots = NULL;
+    img->refs = 1;
+    img->pixels = make(Color, (ulong)width * height);
+    if(!img->pixels) {
+        error("Unable to allocate %u x %u image", width, height);
+        free(img);
+        return NULL;
+    }
+
+    return img;
+}
+
+ppm_image_t* create_ppm_image(uint width, uint height, uint max_color) {
+    ppm_image_t* img = alloc_ppm_image(width, height, max_color);
+    if(!img) return NULL;
+
+    // Initialize with white
+    Color white = { 255, 255, 255, 255 };
+    for(ulong i = 0; i < (ulong)width * height; i++) {
+        img->pixels[i] = white;
+    }
+
+    return img;
+}
+
+void free_ppm_image(ppm_image_t* img) {
+    if(!img) return;
+    if(--img->refs > 0) return;
+    free(img->pixels);
+    free(img->palette);
+    free(img->index8);
+    free(img->index16);
+    free(img->palette_slots);
+    free(img);
+}
+
+// Private copy in the same storage mode, for writing to a shared image
+ppm_image_t* clone_ppm_image(const ppm_image_t* img) {
+    ppm_image_t* copy = make(ppm_image_t);
+    guardn(copy, "Unable to allocate image");
+    *copy = *img;
+    copy->pixels = NULL;
+    copy->palette = NULL;
+    copy->index8 = NULL;
+    copy->index16 = NULL;
+    copy->palette_slots = NULL;
+    copy->refs = 1;
+
+    ulong n = (ulong)img->width * img->height;
+    bool ok;
+    if(!ppm_indexed(img)) {
+        copy->pixels = make(Color, n ? n : 1);
+        ok = copy->pixels != NULL;
+        if(ok) memcpy(copy->pixels, img->pixels, n * sizeof(Color));
+    } else {
+        uint capacity = img->index8 ? 256 : PALETTE_MAX_COLORS;
+        copy->palette = make(Color, capacity);
+        ok = copy->palette != NULL;
+        if(ok) memcpy(copy->palette, img->palette, img->palette_size * sizeof(Color));
+        if(ok && img->index8) {
+            copy->index8 = make(unsigned char, n ? n : 1);
+            ok = copy->index8 != NULL;
+            if(ok) memcpy(copy->index8, img->index8, n);
+        } else if(ok) {
+            copy->index16 = make(ushort, n ? n : 1);
+            ok = copy->index16 != NULL;
+            if(ok) memcpy(copy->index16, img->index16, n * sizeof(ushort));
+        }
+    }
+
+    if(!ok) {
+        error("Unable to allocate %u x %u image", img->width, img->height);
+        free_ppm_image(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+// Heap bytes held by the image's pixel storage
+ulong ppm_image_bytes(const ppm_image_t* img) {
+    ulong n = (ulong)img->width * img->height;
+    if(!ppm_indexed(img)) return n * sizeof(Color);
+    ulong slots = img->palette_slots ? palette_slot_count(img) * sizeof(int) : 0;
+    if(img->index8) return n + 256 * sizeof(Color) + slots;
+    return n * sizeof(ushort) + PALETTE_MAX_COLORS * sizeof(Color) + slots;
+}
+
+// FNV-1a over the size and pixels, to check replays end on the same image
+ulong hash_ppm_image(const ppm_image_t* img) {
+    ulong h = 0xcbf29ce484222325UL;
+    ulong header[2] = { img->width, img->height };
+    const unsigned char* bytes = (const unsigned char*)header;
+    for(usize i = 0; i < sizeof(header); i++) {
+        h = (h ^ bytes[i]) * 0x100000001b3UL;
+    }
+
+    // Hashed as expanded colors, so indexed and direct storage agree
+    for(ulong i = 0; i < (ulong)img->width * img->height; i++) {
+        Color c = ppm_pixel(img, i);
+        bytes = (const unsigned char*)&c;
+        for(usize k = 0; k < sizeof(Color); k++) {
+            h = (h ^ bytes[k]) * 0x100000001b3UL;
+        }
+    }
+    return h;
+}
+
+// Switch to palette storage when the image has few enough colors, one byte per
+// pixel up to 256 colors and two up to 65536. Returns false and leaves the
+// image untouched when it has more
+bool ppm_image_index(ppm_image_t* img) {
+    if(ppm_indexed(img)) return true;
+
+    ulong n = (ulong)img->width * img->height;
+    uint* keys = make(uint, PALETTE_SLOTS);
+    int* slots = make(int, PALETTE_SLOTS);
+    Color* palette = make(Color, PALETTE_MAX_COLORS);
+    ushort* index16 = make(ushort, n ? n : 1);
+    bool ok = keys && slots && palette && index16;
+    if(!ok) error("Unable to allocate palette for %u x %u image", img->width, img->height);
+
+    // Open-addressed color -> index table, runs of one color skip the lookup
+    uint count = 0;
+    if(ok) memset(slots, 0xff, PALETTE_SLOTS * sizeof(int));
+    uint last_key = 0;
+    int last_index = -1;
+    for(ulong i = 0; ok && i < n; i++) {
+        Color c = img->pixels[i];
+        uint key = palette_key(c);
+        if(key != last_key || last_index < 0) {
+            uint slot = palette_slot(key, PALETTE_SLOTS);
+            while(slots[slot] >= 0 && keys[slot] != key) slot = (slot + 1) & (PALETTE_SLOTS - 1);
+            if(slots[slot] < 0) {
+                if(count == PALETTE_MAX_COLORS) {
+                    ok = false;
+                    break;
+                }
+                keys[slot] = key;
+                slots[slot] = count;
+                palette[count++] = c;
+            }
+            last_key = key;
+            last_index = slots[slot];
+        }
+        index16[i] = (ushort)last_index;
+    }
+
+    free(keys);
+    free(slots);
+    if(!ok) {
+        free(palette);
+        free(index16);
+        return false;
+    }
+
+    if(count <= 256) {
+        unsigned char* index8 = make(unsigned char, n ? n : 1);
+        if(index8) {
+            for(ulong i = 0; i < n; i++) {
+                index8[i] = (unsigned char)index16[i];
+            }
+            free(index16);
+            index16 = NULL;
+            img->index8 = index8;
+        }
+    }
+
+    // 8-bit images keep a 256-entry palette and widen when it fills up
+    if(img->index8) {
+        Color* shrunk = realloc(palette, 256 * sizeof(Color));
+        if(shrunk) palette = shrunk;
+    }
+
+    img->index16 = index16;
+    img->palette = palette;
+    img->palette_size = count;
+    free(img->pixels);
+    img->pixels = NULL;
+    return true;
+}
+
+// Back to direct storage, false if it can't be allocated
+bool ppm_image_expand(ppm_image_t* img) {
+    if(!ppm_indexed(img)) return true;
+
+    ulong n = (ulong)img->width * img->height;
+    Color* pixels = make(Color, n ? n : 1);
+    if(!pixels) {
+        error("Unable to allocate %u x %u image", img->width, img->height);
+        return false;
+    }
+
+    for(ulong i = 0; i < n; i++) {
+        pixels[i] = img->palette[ppm_index_at(img, i)];
+    }
+
+    free(img->palette);
+    free(img->index8);
+    free(img->index16);
+    free(img->palette_slots);
+    img->palette = NULL;
+    img->palette_size = 0;
+    img->index8 = NULL;
+    img->index16 = NULL;
+    img->palette_slots = NULL;
+    img->pixels = pixels;
+    return true;
+}
+
+// Rebuilds the color -> index table for the current palette and capacity
+static bool palette_rehash(ppm_image_t* img) {
+    uint slot_count = palette_slot_count(img);
+    int* slots = realloc(img->palette_slots, slot_count * sizeof(int));
+    if(!slots) {
+        // A table sized for the old capacity must not be probed with the new one
+        free(img->palette_slots);
+        img->palette_slots = NULL;
+        error("Unable to allocate palette lookup");
+        return false;
+    }
+
+    memset(slots, 0xff, slot_count * sizeof(int));
+    for(uint i = 0; i < img->palette_size; i++) {
+        uint key = palette_key(img->palette[i]);
+        uint slot = palette_slot(key, slot_count);
+        while(slots[slot] >= 0) slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = i;
+    }
+    img->palette_slots = slots;
+    return true;
+}
+
+// Drops palette entries no pixel uses anymore, fills and stamps leave their old
+// colors behind. Narrows back to 8-bit indices when the rest fits
+static bool palette_compact(ppm_image_t* img) {
+    ulong n = (ulong)img->width * img->height;
+    int* remap = make(int, img->palette_size ? img->palette_size : 1);
+    if(!remap) {
+        error("Unable to allocate palette remap");
+        return false;
+    }
+    memset(remap, 0xff, img->palette_size * sizeof(int));
+
+    for(ulong i = 0; i < n; i++) {
+        remap[ppm_index_at(img, i)] = 0;
+    }
+
+    uint used = 0;
+    for(uint p = 0; p < img->palette_size; p++) {
+        if(remap[p] < 0) continue;
+        img->palette[used] = img->palette[p];
+        remap[p] = used++;
+    }
+
+    if(used == img->palette_size) {
+        free(remap);
+        return true;
+    }
+
+    unsigned char* index8 = img->index16 && used < 256 ? make(unsigned char, n ? n : 1) : NULL;
+    if(index8) {
+        for(ulong i = 0; i < n; i++) {
+            index8[i] = (unsigned char)remap[img->index16[i]];
+        }
+        free(img->index16);
+        img->index16 = NULL;
+        img->index8 = index8;
+
+        Color* shrunk = realloc(img->palette, 256 * sizeof(Color));
+        if(shrunk) img->palette = shrunk;
+    } else {
+        for(ulong i = 0; i < n; i++) {
+            ppm_set_index(img, i, remap[ppm_index_at(img, i)]);
+        }
+    }
+
+    img->palette_size = used;
+    free(remap);
+    return palette_rehash(img);
+}
+
+// Palette index of c, added when missing. -1 when the palette is full of
+// colors still in use and the caller has to fall back to direct storage
+int ppm_palette_index(ppm_image_t* img, Color c) {
+    if(!img->palette_slots && !palette_rehash(img)) return -1;
+
+    uint key = palette_key(c);
+    uint slot_count = palette_slot_count(img);
+    for(uint slot = palette_slot(key, slot_count); img->palette_slots[slot] >= 0; slot = (slot + 1) & (slot_count - 1)) {
+        int index = img->palette_slots[slot];
+        if(colors_equal(img->palette[index], c)) return index;
+    }
+
+    if(img->palette_size == palette_capacity(img)) {
+        if(!palette_compact(img)) return -1;
+        slot_count = palette_slot_count(img);
+    }
+    if(img->palette_size == PALETTE_MAX_COLORS) return -1;
+
+    if(img->index8 && img->palette_size == 256) {
+        ulong n = (ulong)img->width * img->height;
+        ushort* index16 = make(ushort, n ? n : 1);
+        Color* palette = realloc(img->palette, PALETTE_MAX_COLORS * sizeof(Color));
+        if(palette) img->palette = palette;
+        if(!index16 || !palette) {
+            free(index16);
+            return -1;
+        }
+
+        for(ulong i = 0; i < n; i++) {
+            index16[i] = img->index8[i];
+        }
+        free(img->index8);
+        img->index8 = NULL;
+        img->index16 = index16;
+        if(!palette_rehash(img)) return -1;
+        slot_count = palette_slot_count(img);
+    }
+
+    uint slot = palette_slot(key, slot_count);
+    while(img->palette_slots[slot] >= 0) slot = (slot + 1) & (slot_count - 1);
+    img->palette_slots[slot] = img->palette_size;
+    img->palette[img->palette_size] = c;
+    return img->palette_size++;
+}
+
+bool ppm_writer_open(ppm_writer_t* w, const char* filepath, uint width, uint height, uint max_color) {
+    *w = (ppm_writer_t){ 0 };
+    w->f = stream_open_write(filepath);
+    if(!w->f) {
+        error("Failed to open file for writing: %s", filepath);
+        return false;
+    }
+
+    w->width = width;
+    w->height = height;
+    w->max_color = max_color;
+    fprintf(w->f, "P3\n%u %u\n%u\n", width, height, max_color);
+    return true;
+}
+
+bool ppm_writer_write_rows(ppm_writer_t* w, const Color* rows, uint count) {
+    float scale = w->max_color / 255.0f;
+    for(ulong i = 0; i < (ulong)w->width * count; i++) {
+        Color c = rows[i];
+        uint r = (uint)(c.r * scale);
+        uint g = (uint)(c.g * scale);
+        uint b = (uint)(c.b * scale);
+        fprintf(w->f, "%u %u %u\n", r, g, b);
+    }
+
+    w->rows_written += count;
+    return !ferror(w->f);
+}
+
+bool ppm_writer_close(ppm_writer_t* w) {
+    if(!w->f) return false;
+    bool ok = !ferror(w->f) && w->rows_written == w->height;
+    if(fclose(w->f) != 0) ok = false;
+    w->f = NULL;
+    return ok;
+}
+
+bool ppm_reader_open(ppm_reader_t* r, const char* filepath) {
+    *r = (ppm_reader_t){ 0 };
+    r->f = stream_open_read(filepath);
+    if(!r->f) {
+        error("Failed to open file for reading: %s", filepath);
+        return false;
+    }
+
+    char magic[3];
+    if(fscanf(r->f, "%2s", magic) != 1 || magic[0] != 'P' || magic[1] != '3') {
+        error("Invalid PPM file format: %s", filepath);
+        ppm_reader_close(r);
+        return false;
+    }
+
+    if(fscanf(r->f, "%u %u %u", &r->width, &r->height, &r->max_color) != 3 || r->max_color == 0) {
+        error("Failed to read PPM header: %s", filepath);
+        ppm_reader_close(r);
+        return false;
+    }
+
+    return true;
+}
+
+bool ppm_reader_read_rows(ppm_reader_t* r, Color* rows, uint count) {
+    if(r->rows_read + count > r->height) {
+        error("Read past the end of PPM pixel data");
+        return false;
+    }
+
+    float scale = 255.0f / r->max_color;
+    for(ulong i = 0; i < (ulong)r->width * count; i++) {
+        uint cr, cg, cb;
+        if(fscanf(r->f, "%u %u %u", &cr, &cg, &cb) != 3) {
+            error("Failed to read pixel data from PPM");
+            return false;
+        }
+        rows[i] = (Color){ (unsigned char)(cr * scale), (unsigned char)(cg * scale), (unsigned char)(cb * scale), 255 };
+    }
+
+    r->rows_read += count;
+    return true;
+}
+
+void ppm_reader_close(ppm_reader_t* r) {
+    if(r->f) fclose(r->f);
+    r->f = NULL;
+}
+
+bool save_ppm_image(ppm_image_t* img, const char* filepath) {
+    ppm_writer_t w;
+    if(!ppm_writer_open(&w, filepath, img->width, img->height, img->max_color)) return false;
+
+    if(ppm_indexed(img)) {
+        // Expanded a band at a time, saving never needs the full direct buffer
+        Color* band = make(Color, (ulong)img->width * SAVE_BAND_ROWS);
+        if(!band) {
+            error("Unable to allocate row buffer");
+            ppm_writer_close(&w);
+            return false;
+        }
+        for(uint y = 0; y < img->height; y += SAVE_BAND_ROWS) {
+            uint rows = img->height - y < SAVE_BAND_ROWS ? img->height - y : SAVE_BAND_ROWS;
+            ulong base = (ulong)y * img->width;
+            for(ulong i = 0; i < (ulong)rows * img->width; i++) {
+                band[i] = ppm_pixel(img, base + i);
+            }
+            ppm_writer_write_rows(&w, band, rows);
+        }
+        free(band);
+    } else {
+        ppm_writer_write_rows(&w, img->pixels, img->height);
+    }
+    if(!ppm_writer_close(&w)) {
+        error("Failed to write PPM image: %s", filepath);
+        return false;
+    }
+
+    log("Saved PPM image to %s (%u x %u)", filepath, img->width, img->height);
+    return true;
+}
+
+ppm_image_t* load_ppm_image(const char* filepath) {
+    ppm_reader_t r;
+    if(!ppm_reader_open(&r, filepath)) return NULL;
+
+    ppm_image_t* img = alloc_ppm_image(r.width, r.height, r.max_color);
+    if(!img) {
+        ppm_reader_close(&r);
+        return NULL;
+    }
+
+    if(!ppm_reader_read_rows(&r, img->pixels, r.height)) {
+        error("Failed to read pixel data from PPM: %s", filepath);
+        free_ppm_image(img);
+        ppm_reader_close(&r);
+        return NULL;
+    }
+
+    ppm_reader_close(&r);
+    log("Loaded PPM image from %s (%u x %u)", filepath, img->width, img->height);
+    return img;
+}
+
+// What a fill replaces, palette indices on indexed images and colors otherwise
+typedef struct fill_target {
+    ppm_image_t* img;
+    bool indexed;
+    uint old_index;
+    uint new_index;
+    Color old_color;
+    Color new_color;
+} fill_target_t;
+
+typedef struct fill_seed {
+    int x;
+    int y;
+} fill_seed_t;
+
+static inline bool fill_match(const fill_target_t* t, ulong i) {
+    if(t->indexed) return ppm_index_at(t->img, i) == t->old_index;
+    return colors_equal(t->img->pixels[i], t->old_color);
+}
+
+static inline void fill_set(const fill_target_t* t, ulong i) {
+    if(t->indexed) {
+        ppm_set_index(t->img, i, t->new_index);
+    } else {
+        t->img->pixels[i] = t->new_color;
+    }
+}
+
+static bool fill_push(fill_seed_t** stack, usize* size, usize* capacity, int x, int y) {
+    if(*size == *capacity) {
+        fill_seed_t* grown = realloc(*stack, sizeof(fill_seed_t) * *capacity * 2);
+        if(!grown) return false;
+        *stack = grown;
+        *capacity *= 2;
+    }
+    (*stack)[(*size)++] = (fill_seed_t){ x, y };
+    return true;
+}
+
+// One seed per run of matching pixels in row y between x0 and x1
+static bool fill_push_runs(const fill_target_t* t, fill_seed_t** stack, usize* size, usize* capacity, int x0, int x1, int y) {
+    if(y < 0 || y >= (int)t->img->height) return true;
+
+    ulong row = (ulong)y * t->img->width;
+    bool in_run = false;
+    for(int x = x0; x <= x1; x++) {
+        bool match = fill_match(t, row + x);
+        if(match && !in_run && !fill_push(stack, size, capacity, x, y)) return false;
+        in_run = match;
+    }
+    return true;
+}
+
+// Scanline fill: each seed is widened to its whole run, which is filled at once,
+// and the rows above and below push one seed per matching run. The stack holds
+// runs rather than pixels, so it stays small even for whole-image fills
+static rect_t fill_scanlines(const fill_target_t* t, int x, int y, ulong* filled) {
+    ppm_image_t* img = t->img;
+    int min_x = x, min_y = y, max_x = x, max_y = y;
+    ulong count = 0;
+
+    usize size = 0;
+    usize capacity = 256;
+    fill_seed_t* stack = make(fill_seed_t, capacity);
+    bool ok = stack && fill_push(&stack, &size, &capacity, x, y);
+
+    while(ok && size > 0) {
+        fill_seed_t seed = stack[--size];
+        ulong row = (ulong)seed.y * img->width;
+        if(!fill_match(t, row + seed.x)) continue;
+
+        int x0 = seed.x;
+        int x1 = seed.x;
+        while(x0 > 0 && fill_match(t, row + x0 - 1)) x0--;
+        while(x1 + 1 < (int)img->width && fill_match(t, row + x1 + 1)) x1++;
+
+        for(int px = x0; px <= x1; px++) {
+            fill_set(t, row + px);
+        }
+        count += x1 - x0 + 1;
+        if(x0 < min_x) min_x = x0;
+        if(x1 > max_x) max_x = x1;
+        if(seed.y < min_y) min_y = seed.y;
+        if(seed.y > max_y) max_y = seed.y;
+
+        ok = fill_push_runs(t, &stack, &size, &capacity, x0, x1, seed.y - 1)
+            && fill_push_runs(t, &stack, &size, &capacity, x0, x1, seed.y + 1);
+    }
+
+    if(!ok) error("Unable to grow flood fill stack, fill is incomplete");
+    free(stack);
+
+    if(filled) *filled = count;
+    if(count == 0) return (rect_t){ 0, 0, 0, 0 };
+    return (rect_t){ min_x, min_y, max_x - min_x + 1, max_y - min_y + 1 };
+}
+
+rect_t flood_fill(ppm_image_t* img, int x, int y, Color new_color, ulong* filled) {
+    rect_t dirty = { 0, 0, 0, 0 };
+    if(filled) *filled = 0;
+    if(x < 0 || x >= (int)img->width || y < 0 || y >= (int)img->height) return dirty;
+
+    fill_target_t t = { .img = img, .new_color = new_color };
+    ulong seed = (ulong)y * img->width + x;
+
+    // Indexed images only fall back to direct storage once the palette is full
+    if(ppm_indexed(img)) {
+        int index = ppm_palette_index(img, new_color);
+        if(index >= 0) {
+            t.indexed = true;
+            t.old_index = ppm_index_at(img, seed);
+            t.new_index = index;
+            if(t.old_index == t.new_index) return dirty;
+            return fill_scanlines(&t, x, y, filled);
+        }
+        if(!ppm_image_expand(img)) return dirty;
+    }
+
+    t.old_color = img->pixels[seed];
+    if(colors_equal(t.old_color, new_color)) return dirty;
+    return fill_scanlines(&t, x, y, filled);
+}
+
+rect_t clip_rect(rect_t r, uint width, uint height) {
+    if(r.width < 0) { r.x += r.width; r.width = -r.width; }
+    if(r.height < 0) { r.y += r.height; r.height = -r.height; }
+
+    int x0 = r.x < 0 ? 0 : r.x;
+    int y0 = r.y < 0 ? 0 : r.y;
+    int x1 = r.x + r.width > (int)width ? (int)width : r.x + r.width;
+    int y1 = r.y + r.height > (int)height ? (int)height : r.y + r.height;
+
+    if(x1 <= x0 || y1 <= y0) return (rect_t){ 0, 0, 0, 0 };
+    return (rect_t){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+rect_t rect_union(rect_t a, rect_t b) {
+    if(rect_empty(a)) return b;
+    if(rect_empty(b)) return a;
+
+    int x0 = a.x < b.x ? a.x : b.x;
+    int y0 = a.y < b.y ? a.y : b.y;
+    int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return (rect_t){ x0, y0, x1 - x0, y1 - y0 };
+}
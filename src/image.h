@@ -0,0 +1,120 @@
+#ifndef PRISM_IMAGE_H
+#define PRISM_IMAGE_H
+
+#include <raylib.h>
+
+#include "utils.h"
+
+static const ulong MAX_PIXELS = 268435456; // 16384^2
+
+// Largest palette of an indexed image, 8-bit indices are used up to 256 colors
+#define PALETTE_MAX_COLORS 65536
+
+typedef struct ppm_image {
+    uint width;
+    uint height;
+    uint max_color;
+    Color* pixels; // direct storage, NULL while the image is indexed
+
+    // Palette storage for low-color images, exactly one of index8/index16 is
+    // set while indexed. Entries are distinct, palette_size <= 256 for index8
+    Color* palette;
+    uint palette_size;
+    unsigned char* index8;
+    ushort* index16;
+    int* palette_slots; // open-addressed color -> index table, built on first lookup
+
+    uint refs; // documents sharing this image copy-on-write, freed at zero
+} ppm_image_t;
+
+// Integer pixel rectangle, used for selections and changed regions
+typedef struct rect {
+    int x;
+    int y;
+    int width;
+    int height;
+} rect_t;
+
+// Row-band PPM streams, for images that are processed without being held whole.
+// gzip/zstd files are (de)compressed on a second thread while rows are parsed
+typedef struct ppm_reader {
+    FILE* f;
+    uint width;
+    uint height;
+    uint max_color;
+    uint rows_read;
+} ppm_reader_t;
+
+typedef struct ppm_writer {
+    FILE* f;
+    uint width;
+    uint height;
+    uint max_color;
+    uint rows_written;
+} ppm_writer_t;
+
+ppm_image_t* create_ppm_image(uint width, uint height, uint max_color);
+ppm_image_t* alloc_ppm_image(uint width, uint height, uint max_color);
+void free_ppm_image(ppm_image_t* img);
+ppm_image_t* clone_ppm_image(const ppm_image_t* img);
+ulong ppm_image_bytes(const ppm_image_t* img);
+ulong hash_ppm_image(const ppm_image_t* img);
+
+bool ppm_image_index(ppm_image_t* img);
+bool ppm_image_expand(ppm_image_t* img);
+int ppm_palette_index(ppm_image_t* img, Color c);
+
+bool save_ppm_image(ppm_image_t* img, const char* filepath);
+ppm_image_t* load_ppm_image(const char* filepath);
+
+bool ppm_reader_open(ppm_reader_t* r, const char* filepath);
+bool ppm_reader_read_rows(ppm_reader_t* r, Color* rows, uint count);
+void ppm_reader_close(ppm_reader_t* r);
+
+bool ppm_writer_open(ppm_writer_t* w, const char* filepath, uint width, uint height, uint max_color);
+bool ppm_writer_write_rows(ppm_writer_t* w, const Color* rows, uint count);
+bool ppm_writer_close(ppm_writer_t* w);
+
+// Edits return the rectangle they touched so dependent state can update incrementally
+rect_t flood_fill(ppm_image_t* img, int x, int y, Color new_color, ulong* filled);
+
+rect_t clip_rect(rect_t r, uint width, uint height);
+rect_t rect_union(rect_t a, rect_t b);
+
+static inline bool colors_equal(Color a, Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static inline bool rect_empty(rect_t r) {
+    return r.width <= 0 || r.height <= 0;
+}
+
+static inline bool ppm_indexed(const ppm_image_t* img) {
+    return img->pixels == NULL;
+}
+
+static inline uint ppm_index_at(const ppm_image_t* img, ulong i) {
+    return img->index8 ? img->index8[i] : img->index16[i];
+}
+
+static inline void ppm_set_index(ppm_image_t* img, ulong i, uint index) {
+    if(img->index8) {
+        img->index8[i] = (unsigned char)index;
+    } else {
+        img->index16[i] = (ushort)index;
+    }
+}
+
+// Pixel i in row-major order, through the palette when the image is indexed
+static inline Color ppm_pixel(const ppm_image_t* img, ulong i) {
+    if(img->pixels) return img->pixels[i];
+    return img->palette[ppm_index_at(img, i)];
+}
+
+// Another reference to img, whoever writes to it first clones it
+static inline ppm_image_t* share_ppm_image(ppm_image_t* img) {
+    img->refs++;
+    return img;
+}
+
+#endif // PRISM_IMAGE_H
@@ -5,18 +5,18 @@
 #undef RAYGUI_IMPLEMENTATION
 
 #include "utils.h"
+#include "image.h"
+#include "selection.h"
+#include "brush.h"
+#include "compare.h"
+#include "stats.h"
+#include "replay.h"
+#include "browser.h"
+#include "document.h"
 #include <unistd.h>
 
 static const int INITIAL_WIDTH = 800;
 static const int INITIAL_HEIGHT = 600;
-static const ulong MAX_PIXELS = 268435456; // 16384^2
-
-typedef struct ppm_image {
-    uint width;
-    uint height;
-    uint max_color;
-    Color* pixels;
-} ppm_image_t;
 
 typedef enum app_mode {
     MODE_CREATE_IMAGE,
@@ -26,6 +26,8 @@ typedef enum app_mode {
 typedef enum tool_type {
     TOOL_BRUSH,
     TOOL_FILL,
+    TOOL_SELECT,
+    TOOL_COUNT,
 } tool_type_t;
 
 typedef struct state {
@@ -54,260 +56,622 @@ typedef struct state {
     float pan_y;
     Color brush_color;
     tool_type_t current_tool;
-    int brush_radius;
+    brush_t brush;
+    bool stroking;
+    int stroke_x; // last stamped canvas position of the current stroke
+    int stroke_y;
+
+    // Selection and clipboard state
+    selection_t selection;
+    ppm_image_t* clipboard;
+
+    // Compare state, diff of the open image against another file
+    compare_t compare;
+    bool comparing;
+    bool show_heatmap;
+
+    // Statistics panel, kept current from edit regions while shown
+    stats_t stats;
+    bool show_stats;
+
+    // Keep low-color images as palette indices, tools without an indexed path expand them
+    bool indexed_storage;
+
+    // Open documents. The active one lives in the fields above (image,
+    // current_filepath, zoom, pan, selection, compare, stats) while it's edited
+    documents_t docs;
 
     // Color picker state
     bool color_picker_active;
     int color_r;
     int color_g;
     int color_b;
+
+    // File browser, the picked path is dispatched as browser_action
+    browser_t browser;
+    action_type_t browser_action;
+
+    // Input for the current frame, polled or replayed, and the optional session log
+    input_t input;
+    recorder_t* recorder;
+    bool replaying; // UI is locked, actions come from the recording
+    bool single_document; // replaying a recording made before tabs
 } state_t;
 
+// Copies the active document's live fields into its table entry, ownership stays
+// with state so this is safe to repeat
+void document_sync(state_t* state) {
+    if(state->docs.active < 0) return;
+
+    document_t* doc = &state->docs.items[state->docs.active];
+    doc->image = state->image;
+    snprintf(doc->filepath, sizeof(doc->filepath), "%s", state->current_filepath);
+    doc->zoom = state->zoom;
+    doc->pan_x = state->pan_x;
+    doc->pan_y = state->pan_y;
+    doc->selection = state->selection;
+    doc->compare = state->compare;
+    doc->comparing = state->comparing;
+    doc->stats = state->stats;
+}
+
 void free_state(state_t* state) {
-    if(state->image) {
-        free(state->image->pixels);
-        free(state->image);
-    }
+    free_ppm_image(state->selection.floating);
+    state->selection.floating = NULL;
+    document_sync(state);
+    documents_free(&state->docs);
+    free_ppm_image(state->clipboard);
+    brush_free(&state->brush);
+    browser_free(&state->browser);
     free(state);
 }
 
-ppm_image_t* create_ppm_image(uint width, uint height, uint max_color) {
-    if((ulong)width * height > MAX_PIXELS) {
-        error("Image too large: %u * %u > %lu", width, height, MAX_PIXELS);
-        return NULL;
-    }
+void calculate_zoom_to_fit(state_t* state) {
+    if(!state->image) return;
 
-    ppm_image_t* img = make(ppm_image_t);
-    img->width = width;
-    img->height = height;
-    img->max_color = max_color;
-    img->pixels = make(Color, width * height);
+    // Available screen area (accounting for toolbar and panels)
+    float available_width = state->width - 20.0f;
+    float available_height = state->height - 210.0f;
 
-    // Initialize with white
-    Color white = { 255, 255, 255, 255 };
-    for(ulong i = 0; i < (ulong)width * height; i++) {
-        img->pixels[i] = white;
-    }
+    // Calculate zoom needed to fit image
+    float zoom_for_width = available_width / state->image->width;
+    float zoom_for_height = available_height / state->image->height;
 
-    return img;
+    // Use the smaller zoom to ensure it fits
+    state->zoom = zoom_for_width < zoom_for_height ? zoom_for_width : zoom_for_height;
+
+    // Center the image
+    float image_screen_width = state->image->width * state->zoom;
+    float image_screen_height = state->image->height * state->zoom;
+    state->pan_x = (available_width - image_screen_width) / 2.0f + 10.0f;
+    state->pan_y = (available_height - image_screen_height) / 2.0f + 60.0f;
 }
 
-bool file_dialog_open(char* filepath, size_t filepath_size) {
-    // Use zenity for file dialog on Linux
-    FILE* cmd = popen("zenity --file-selection --filename=$HOME --title=\"Open PPM Image\" 2>/dev/null", "r");
-    if(!cmd) {
-        error("Failed to open file dialog");
-        return false;
+void compare_clear(state_t* state) {
+    compare_free(&state->compare);
+    state->comparing = false;
+}
+
+// Called whenever state->image is replaced or resized as a whole. Runs on the
+// update path only, so headless replays that never draw end in the same state
+void image_changed(state_t* state) {
+    // Comparison is a snapshot, drop it once the image no longer matches its size
+    if(state->comparing && (!state->image || state->compare.width != state->image->width || state->compare.height != state->image->height)) {
+        compare_clear(state);
     }
 
-    if(fgets(filepath, filepath_size, cmd) == NULL) {
-        pclose(cmd);
-        return false;
+    // Rescanning a large image takes a while, update() adopts the result once it's ready
+    stats_free(&state->stats);
+    if(state->image && state->show_stats) {
+        stats_compute_async(&state->stats, state->image);
     }
+}
+
+// Evict caches of inactive documents until everything fits the memory budget
+void enforce_budget(state_t* state) {
+    document_sync(state);
+    state->docs.may_index = state->indexed_storage;
+    documents_trim(&state->docs);
+}
 
-    pclose(cmd);
+// Before writing to the open image, gives the active document its own copy
+// when a duplicate still shares it
+bool ensure_writable(state_t* state) {
+    // Background statistics read the pixels without holding a reference
+    stats_cancel(&state->stats);
+    if(!state->image || state->image->refs == 1) return true;
+
+    ppm_image_t* copy = clone_ppm_image(state->image);
+    if(!copy) return false;
+    free_ppm_image(state->image);
+    state->image = copy;
+    enforce_budget(state);
+    return true;
+}
 
-    // Remove trailing newline
-    size_t len = strlen(filepath);
-    if(len > 0 && filepath[len - 1] == '\n') {
-        filepath[len - 1] = '\0';
+// Switch the open image to palette storage if it has few enough colors.
+// Storage changes in place, so a duplicate sharing the image gets a copy first
+void index_image(state_t* state) {
+    if(!state->image || ppm_indexed(state->image)) return;
+    guardv_nl(ensure_writable(state));
+
+    ppm_image_t* img = state->image;
+    if(ppm_image_index(img)) {
+        log("Indexed image: %u colors, %d-bit indices", img->palette_size, img->index8 ? 8 : 16);
+    } else {
+        log("Image has more than %d colors, keeping direct storage", PALETTE_MAX_COLORS);
     }
+}
 
-    return filepath[0] != '\0';
+// For edits that only work on direct storage, also copies a shared image first
+bool ensure_direct(state_t* state) {
+    if(!state->image || !ppm_indexed(state->image)) return true;
+    return ensure_writable(state) && ppm_image_expand(state->image);
 }
 
-bool file_dialog_save(char* filepath, size_t filepath_size) {
-    // Use zenity for save dialog on Linux
-    FILE* cmd = popen("zenity --file-selection --save --filename=$HOME/output.ppm --title=\"Save PPM Image\" 2>/dev/null", "r");
-    if(!cmd) {
-        error("Failed to open save dialog");
-        return false;
-    }
+// In-place edits of the open image, keeping the statistics in step
+void edit_fill(state_t* state, rect_t r, Color color) {
+    guardv_nl(ensure_writable(state) && ensure_direct(state));
+    stats_remove_region(&state->stats, state->image, r);
+    fill_region(state->image, r, color);
+    stats_add_region(&state->stats, state->image, r);
+}
 
-    if(fgets(filepath, filepath_size, cmd) == NULL) {
-        pclose(cmd);
-        return false;
-    }
+// False when the image couldn't be made writable and nothing was pasted
+bool edit_paste(state_t* state, const ppm_image_t* src, int x, int y) {
+    if(!ensure_writable(state) || !ensure_direct(state)) return false;
+    rect_t r = { x, y, src->width, src->height };
+    stats_remove_region(&state->stats, state->image, r);
+    paste_region(state->image, src, x, y);
+    stats_add_region(&state->stats, state->image, r);
+    return true;
+}
 
-    pclose(cmd);
+void selection_commit(state_t* state) {
+    selection_t* sel = &state->selection;
+    if(!sel->floating) return;
+
+    // Keep the lifted pixels floating rather than lose them
+    if(!edit_paste(state, sel->floating, sel->rect.x, sel->rect.y)) return;
+    free_ppm_image(sel->floating);
+    sel->floating = NULL;
+    sel->moving = false;
+    sel->rect = clip_rect(sel->rect, state->image->width, state->image->height);
+    sel->active = !rect_empty(sel->rect);
+}
 
-    // Remove trailing newline
-    size_t len = strlen(filepath);
-    if(len > 0 && filepath[len - 1] == '\n') {
-        filepath[len - 1] = '\0';
-    }
+void selection_clear(state_t* state) {
+    free_ppm_image(state->selection.floating);
+    state->selection = (selection_t){ 0 };
+}
 
-    return filepath[0] != '\0';
+// Region the transforms act on, the whole image when nothing is selected
+rect_t selection_target(state_t* state) {
+    if(state->selection.active) return state->selection.rect;
+    return (rect_t){ 0, 0, state->image->width, state->image->height };
 }
 
-bool save_ppm_image(ppm_image_t* img, const char* filepath) {
-    FILE* f = fopen(filepath, "w");
-    if(!f) {
-        error("Failed to open file for writing: %s", filepath);
-        return false;
-    }
+void selection_copy(state_t* state) {
+    selection_commit(state);
+    guardv_nl(ensure_direct(state));
+    ppm_image_t* copied = copy_region(state->image, selection_target(state));
+    if(!copied) return;
 
-    fprintf(f, "P3\n%u %u\n%u\n", img->width, img->height, img->max_color);
+    free_ppm_image(state->clipboard);
+    state->clipboard = copied;
+    log("Copied %ux%u region", copied->width, copied->height);
+}
 
-    float scale = img->max_color / 255.0f;
-    for(ulong i = 0; i < (ulong)img->width * img->height; i++) {
-        Color c = img->pixels[i];
-        uint r = (uint)(c.r * scale);
-        uint g = (uint)(c.g * scale);
-        uint b = (uint)(c.b * scale);
-        fprintf(f, "%u %u %u\n", r, g, b);
-    }
+void selection_cut(state_t* state) {
+    selection_copy(state);
+    edit_fill(state, selection_target(state), WHITE);
+}
 
-    fclose(f);
-    log("Saved PPM image to %s (%u x %u)", filepath, img->width, img->height);
-    return true;
+void selection_paste(state_t* state) {
+    guardv(state->clipboard, "Clipboard is empty");
+    selection_commit(state);
+
+    int x = state->selection.active ? state->selection.rect.x : 0;
+    int y = state->selection.active ? state->selection.rect.y : 0;
+    edit_paste(state, state->clipboard, x, y);
+
+    state->selection.rect = clip_rect((rect_t){ x, y, state->clipboard->width, state->clipboard->height }, state->image->width, state->image->height);
+    state->selection.active = !rect_empty(state->selection.rect);
 }
 
-ppm_image_t* load_ppm_image(const char* filepath) {
-    FILE* f = fopen(filepath, "r");
-    if(!f) {
-        error("Failed to open file for reading: %s", filepath);
-        return NULL;
+void selection_crop(state_t* state) {
+    selection_commit(state);
+    guardv(state->selection.active, "Nothing selected to crop to");
+    guardv_nl(ensure_writable(state) && ensure_direct(state));
+
+    if(crop_image(state->image, state->selection.rect)) {
+        selection_clear(state);
+        image_changed(state);
+        calculate_zoom_to_fit(state);
+        log("Cropped image to %ux%u", state->image->width, state->image->height);
     }
+}
 
-    char magic[3];
-    uint width, height, max_color;
-    if(fscanf(f, "%2s", magic) != 1 || magic[0] != 'P' || magic[1] != '3') {
-        error("Invalid PPM file format: %s", filepath);
-        fclose(f);
-        return NULL;
+void selection_flip(state_t* state, bool horizontal) {
+    selection_commit(state);
+    guardv_nl(ensure_writable(state) && ensure_direct(state));
+    if(horizontal) {
+        flip_horizontal(state->image, selection_target(state));
+    } else {
+        flip_vertical(state->image, selection_target(state));
     }
+}
 
-    if(fscanf(f, "%u %u %u", &width, &height, &max_color) != 3) {
-        error("Failed to read PPM header: %s", filepath);
-        fclose(f);
-        return NULL;
+void selection_rotate(state_t* state, bool clockwise) {
+    selection_commit(state);
+    guardv_nl(ensure_direct(state));
+
+    if(!state->selection.active) {
+        ppm_image_t* rotated = rotate_image_90(state->image, clockwise);
+        if(!rotated) return;
+        stats_free(&state->stats);
+        free_ppm_image(state->image);
+        state->image = rotated;
+        image_changed(state);
+        calculate_zoom_to_fit(state);
+        return;
     }
 
-    ppm_image_t* img = create_ppm_image(width, height, max_color);
-    if(!img) {
-        fclose(f);
-        return NULL;
+    // Lift the selection, rotate it and drop it back around the same center
+    rect_t r = state->selection.rect;
+    ppm_image_t* lifted = copy_region(state->image, r);
+    if(!lifted) return;
+    ppm_image_t* rotated = rotate_image_90(lifted, clockwise);
+    free_ppm_image(lifted);
+    if(!rotated) return;
+
+    edit_fill(state, r, WHITE);
+    int x = r.x + (r.width - (int)rotated->width) / 2;
+    int y = r.y + (r.height - (int)rotated->height) / 2;
+    edit_paste(state, rotated, x, y);
+
+    state->selection.rect = clip_rect((rect_t){ x, y, rotated->width, rotated->height }, state->image->width, state->image->height);
+    state->selection.active = !rect_empty(state->selection.rect);
+    free_ppm_image(rotated);
+}
+
+void compare_with_file(state_t* state, const char* filepath) {
+    ppm_image_t* other = load_ppm_image(filepath);
+    if(!other) {
+        error("Failed to load PPM file");
+        return;
     }
 
-    float scale = 255.0f / max_color;
-    for(ulong i = 0; i < (ulong)width * height; i++) {
-        uint r, g, b;
-        if(fscanf(f, "%u %u %u", &r, &g, &b) != 3) {
-            error("Failed to read pixel data from PPM: %s", filepath);
-            free(img->pixels);
-            free(img);
-            fclose(f);
-            return NULL;
-        }
-        img->pixels[i] = (Color){ (unsigned char)(r * scale), (unsigned char)(g * scale), (unsigned char)(b * scale), 255 };
+    selection_commit(state);
+    compare_clear(state);
+    if(!ensure_direct(state)) {
+        free_ppm_image(other);
+        return;
     }
+    state->comparing = compare_images(&state->compare, state->image, other, 0, true);
+    free_ppm_image(other);
 
-    fclose(f);
-    log("Loaded PPM image from %s (%u x %u)", filepath, width, height);
-    return img;
+    if(state->comparing) {
+        compare_t* c = &state->compare;
+        log("Compared with %s: %lu changed pixels, max error %u, PSNR %.2f dB, %d regions",
+            filepath, c->changed_pixels, c->max_error, c->psnr, c->region_count);
+    }
 }
 
-void calculate_zoom_to_fit(state_t* state) {
-    if(!state->image) return;
+// Moves the active document into the table, leaving state without an image
+void document_park(state_t* state) {
+    if(state->docs.active < 0) return;
 
-    // Available screen area (accounting for toolbar and panels)
-    float available_width = state->width - 20.0f;
-    float available_height = state->height - 210.0f;
+    selection_commit(state);
+    document_sync(state);
+    state->docs.items[state->docs.active].last_used = ++state->docs.clock;
+    state->docs.active = -1;
 
-    // Calculate zoom needed to fit image
-    float zoom_for_width = available_width / state->image->width;
-    float zoom_for_height = available_height / state->image->height;
+    state->image = NULL;
+    state->current_filepath[0] = '\0';
+    state->selection = (selection_t){ 0 };
+    state->compare = (compare_t){ 0 };
+    state->comparing = false;
+    state->stats = (stats_t){ 0 };
+    state->stroking = false;
+}
 
-    // Use the smaller zoom to ensure it fits
-    state->zoom = zoom_for_width < zoom_for_height ? zoom_for_width : zoom_for_height;
+// Makes a parked document active. Its image never left memory and nothing is
+// reloaded: statistics the budget evicted are recomputed in the background and
+// an evicted heatmap stays unavailable until the next compare
+void document_restore(state_t* state, int index) {
+    document_t* doc = &state->docs.items[index];
+    state->docs.active = index;
+    state->mode = MODE_EDITING;
+
+    state->image = doc->image;
+    snprintf(state->current_filepath, sizeof(state->current_filepath), "%s", doc->filepath);
+    state->zoom = doc->zoom;
+    state->pan_x = doc->pan_x;
+    state->pan_y = doc->pan_y;
+    state->selection = doc->selection;
+    state->compare = doc->compare;
+    state->comparing = doc->comparing;
+    state->stats = doc->stats;
+    doc->palette_tried = false; // edits may have brought it under the palette limit
+
+    if(state->show_stats && !state->stats.valid && !state->stats.task) stats_compute_async(&state->stats, state->image);
+}
 
-    // Center the image
-    float image_screen_width = state->image->width * state->zoom;
-    float image_screen_height = state->image->height * state->zoom;
-    state->pan_x = (available_width - image_screen_width) / 2.0f + 10.0f;
-    state->pan_y = (available_height - image_screen_height) / 2.0f + 60.0f;
+// Closing the active document falls back to the one used before it
+void close_document(state_t* state, int index) {
+    guardv(index >= 0 && index < state->docs.count, "No document %d", index);
+
+    bool was_active = index == state->docs.active;
+    if(was_active) {
+        selection_clear(state);
+        document_park(state);
+    }
+    documents_remove(&state->docs, index);
+    if(!was_active) return;
+
+    int recent = documents_recent(&state->docs);
+    if(recent >= 0) {
+        document_restore(state, recent);
+    } else {
+        state->mode = MODE_CREATE_IMAGE;
+    }
 }
 
-static inline bool colors_equal(Color a, Color b) {
-    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+// Opens img in a new tab after the current one is parked
+void document_push(state_t* state, ppm_image_t* img) {
+    // Recordings from before tabs expect a new image to replace the open one
+    if(state->single_document && state->docs.active >= 0) close_document(state, state->docs.active);
+    document_park(state);
+    state->docs.active = documents_add(&state->docs);
+    state->image = img;
+    state->mode = MODE_EDITING;
 }
 
-void flood_fill(ppm_image_t* img, int x, int y, Color new_color) {
-    if(x < 0 || x >= (int)img->width || y < 0 || y >= (int)img->height) return;
+void open_image(state_t* state, const char* filepath) {
+    guardv(state->docs.count < MAX_DOCUMENTS, "At most %d documents can be open", MAX_DOCUMENTS);
 
-    Color old_color = img->pixels[y * img->width + x];
-    if(colors_equal(old_color, new_color)) return;
+    ppm_image_t* loaded = load_ppm_image(filepath);
+    if(!loaded) {
+        error("Failed to load PPM file");
+        return;
+    }
 
-    // Simple iterative flood fill with stack
-    int* stack_x = make(int, img->width * img->height);
-    int* stack_y = make(int, img->width * img->height);
-    int stack_size = 0;
+    document_push(state, loaded);
+    snprintf(state->current_filepath, sizeof(state->current_filepath), "%s", filepath);
+    if(state->indexed_storage) index_image(state);
+    image_changed(state);
+    calculate_zoom_to_fit(state);
+    log("Opened file: %s", filepath);
+}
+
+void new_image(state_t* state, int width, int height, int max_color) {
+    guardv(width > 0 && height > 0 && max_color > 0 && max_color <= 65535, "Invalid parameters");
+    guardv(state->docs.count < MAX_DOCUMENTS, "At most %d documents can be open", MAX_DOCUMENTS);
 
-    stack_x[stack_size] = x;
-    stack_y[stack_size] = y;
-    stack_size++;
+    ppm_image_t* created = create_ppm_image(width, height, max_color);
+    if(!created) return;
 
-    while(stack_size > 0) {
-        stack_size--;
-        int cx = stack_x[stack_size];
-        int cy = stack_y[stack_size];
+    document_push(state, created);
+    if(state->indexed_storage) index_image(state);
+    image_changed(state);
+    calculate_zoom_to_fit(state);
+    log("Created %dx%d PPM image with max color %d", width, height, max_color);
+}
 
-        if(cx < 0 || cx >= (int)img->width || cy < 0 || cy >= (int)img->height) continue;
+// Opens a second tab on the same image, pixels are shared until either writes
+void duplicate_document(state_t* state) {
+    guardv(state->docs.count < MAX_DOCUMENTS, "At most %d documents can be open", MAX_DOCUMENTS);
+
+    selection_commit(state);
+    ppm_image_t* shared = share_ppm_image(state->image);
+    float zoom = state->zoom;
+    float pan_x = state->pan_x;
+    float pan_y = state->pan_y;
+
+    // Both tabs show the same pixels, so the statistics move to the copy instead
+    // of being rescanned. The original gets them back in the background once
+    // it's restored, copying the per-color counts would touch all of them
+    stats_t stats = state->stats;
+    state->stats = (stats_t){ 0 };
+
+    document_push(state, shared);
+    state->zoom = zoom;
+    state->pan_x = pan_x;
+    state->pan_y = pan_y;
+    state->stats = stats;
+    log("Duplicated image, %d documents open", state->docs.count);
+}
 
-        Color current = img->pixels[cy * img->width + cx];
-        if(!colors_equal(current, old_color)) continue;
+void switch_document(state_t* state, int index) {
+    guardv(index >= 0 && index < state->docs.count, "No document %d", index);
+    if(index == state->docs.active) return;
 
-        img->pixels[cy * img->width + cx] = new_color;
+    document_park(state);
+    document_restore(state, index);
+}
 
-        // Add neighbors to stack
-        if(stack_size + 4 < img->width * img->height) {
-            stack_x[stack_size] = cx + 1; stack_y[stack_size] = cy; stack_size++;
-            stack_x[stack_size] = cx - 1; stack_y[stack_size] = cy; stack_size++;
-            stack_x[stack_size] = cx; stack_y[stack_size] = cy + 1; stack_size++;
-            stack_x[stack_size] = cx; stack_y[stack_size] = cy - 1; stack_size++;
-        }
+// Everything the UI can do besides painting, shared by live clicks and replays
+void apply_action(state_t* state, const action_t* action) {
+    bool needs_image = action->type == ACTION_SAVE || action->type == ACTION_COMPARE || action->type == ACTION_DUPLICATE
+        || (action->type >= ACTION_COPY && action->type <= ACTION_ROTATE);
+    guardv(!needs_image || state->image, "No image open for action %d", action->type);
+
+    switch(action->type) {
+        case ACTION_NEW_IMAGE: new_image(state, action->args[0], action->args[1], action->args[2]); break;
+        case ACTION_OPEN: open_image(state, action->path); break;
+        case ACTION_SAVE:
+            selection_commit(state);
+            if(save_ppm_image(state->image, action->path)) {
+                snprintf(state->current_filepath, sizeof(state->current_filepath), "%s", action->path);
+                log("Saved to: %s", action->path);
+            }
+            break;
+        case ACTION_CLOSE_IMAGE: close_document(state, action->args[0]); break;
+        case ACTION_COMPARE: compare_with_file(state, action->path); break;
+        case ACTION_COMPARE_CLOSE: compare_clear(state); break;
+        case ACTION_TOGGLE_HEATMAP: state->show_heatmap = !state->show_heatmap; break;
+        case ACTION_TOGGLE_STATS:
+            state->show_stats = !state->show_stats;
+            image_changed(state);
+            break;
+        // Recordings are read from disk, values the UI can't produce are rejected
+        case ACTION_TOOL:
+            guardv(action->args[0] >= 0 && action->args[0] < TOOL_COUNT, "Invalid tool %d", action->args[0]);
+            state->current_tool = action->args[0];
+            break;
+        case ACTION_BRUSH_RADIUS:
+            guardv(action->args[0] >= BRUSH_RADIUS_MIN && action->args[0] <= BRUSH_RADIUS_MAX, "Invalid brush radius %d", action->args[0]);
+            state->brush.radius = action->args[0];
+            break;
+        case ACTION_BRUSH_HARDNESS:
+            guardv(action->value >= 0.0f && action->value <= 1.0f, "Invalid brush hardness %f", action->value);
+            state->brush.hardness = action->value;
+            break;
+        case ACTION_BRUSH_OPACITY:
+            guardv(action->value >= 0.0f && action->value <= 1.0f, "Invalid brush opacity %f", action->value);
+            state->brush.opacity = action->value;
+            break;
+        case ACTION_BRUSH_MODE:
+            guardv(action->args[0] >= 0 && action->args[0] < BLEND_MODE_COUNT, "Invalid blend mode %d", action->args[0]);
+            state->brush.mode = action->args[0];
+            break;
+        case ACTION_COLOR:
+            state->color_r = action->args[0];
+            state->color_g = action->args[1];
+            state->color_b = action->args[2];
+            break;
+        case ACTION_COPY: selection_copy(state); break;
+        case ACTION_CUT: selection_cut(state); break;
+        case ACTION_PASTE: selection_paste(state); break;
+        case ACTION_CROP: selection_crop(state); break;
+        case ACTION_FLIP: selection_flip(state, action->args[0]); break;
+        case ACTION_ROTATE: selection_rotate(state, action->args[0]); break;
+        case ACTION_TOGGLE_INDEXED:
+            state->indexed_storage = !state->indexed_storage;
+            if(state->indexed_storage) {
+                index_image(state);
+            } else {
+                ensure_direct(state);
+            }
+            break;
+        case ACTION_NEW_TAB:
+            document_park(state);
+            state->mode = MODE_CREATE_IMAGE;
+            break;
+        case ACTION_SWITCH_TAB: switch_document(state, action->args[0]); break;
+        case ACTION_DUPLICATE: duplicate_document(state); break;
+        default: break;
     }
 
-    free(stack_x);
-    free(stack_y);
+    enforce_budget(state);
 }
 
-void paint_brush(ppm_image_t* img, int x, int y, Color color, int radius) {
-    for(int py = y - radius; py <= y + radius; py++) {
-        for(int px = x - radius; px <= x + radius; px++) {
-            if(px >= 0 && px < (int)img->width && py >= 0 && py < (int)img->height) {
-                int dx = px - x;
-                int dy = py - y;
-                if(dx * dx + dy * dy <= radius * radius) {
-                    img->pixels[py * img->width + px] = color;
-                }
+// UI entry point, logs the action when recording before applying it
+void dispatch(state_t* state, action_t action) {
+    if(state->recorder) recorder_action(state->recorder, &action);
+    apply_action(state, &action);
+}
+
+// Show the file browser, the path picked there is applied as action
+void browse(state_t* state, browser_mode_t mode, action_type_t action) {
+    state->browser_action = action;
+    browser_show(&state->browser, mode, state->current_filepath[0] ? state->current_filepath : NULL);
+}
+
+void update_selection_tool(state_t* state, int px, int py) {
+    selection_t* sel = &state->selection;
+
+    if(input_pressed(&state->input, INPUT_MOUSE_LEFT)) {
+        rect_t r = sel->rect;
+        bool inside = sel->active && px >= r.x && px < r.x + r.width && py >= r.y && py < r.y + r.height;
+        if(inside && ensure_direct(state)) {
+            // Grab the selected pixels and move them with the mouse
+            sel->floating = copy_region(state->image, r);
+            if(sel->floating) {
+                edit_fill(state, r, WHITE);
+                sel->moving = true;
+                sel->anchor_x = px - r.x;
+                sel->anchor_y = py - r.y;
             }
+        } else {
+            selection_commit(state);
+            sel->dragging = true;
+            sel->active = false;
+            sel->anchor_x = px;
+            sel->anchor_y = py;
+        }
+    }
+
+    if(input_down(&state->input, INPUT_MOUSE_LEFT)) {
+        if(sel->moving) {
+            sel->rect.x = px - sel->anchor_x;
+            sel->rect.y = py - sel->anchor_y;
+        } else if(sel->dragging) {
+            int x0 = sel->anchor_x < px ? sel->anchor_x : px;
+            int y0 = sel->anchor_y < py ? sel->anchor_y : py;
+            int x1 = sel->anchor_x < px ? px : sel->anchor_x;
+            int y1 = sel->anchor_y < py ? py : sel->anchor_y;
+            sel->rect = clip_rect((rect_t){ x0, y0, x1 - x0 + 1, y1 - y0 + 1 }, state->image->width, state->image->height);
+            sel->active = !rect_empty(sel->rect);
         }
     }
+
+    if(input_released(&state->input, INPUT_MOUSE_LEFT)) {
+        sel->dragging = false;
+        if(sel->moving) selection_commit(state);
+    }
+}
+
+void update_selection_shortcuts(state_t* state) {
+    const input_t* in = &state->input;
+    bool ctrl = input_key_down(in, INPUT_KEY_CTRL);
+
+    if(ctrl && input_key_pressed(in, INPUT_KEY_C)) selection_copy(state);
+    if(ctrl && input_key_pressed(in, INPUT_KEY_X)) selection_cut(state);
+    if(ctrl && input_key_pressed(in, INPUT_KEY_V)) selection_paste(state);
+    if(ctrl && input_key_pressed(in, INPUT_KEY_D)) {
+        selection_commit(state);
+        selection_clear(state);
+    }
+    if(ctrl && input_key_pressed(in, INPUT_KEY_A)) {
+        selection_commit(state);
+        state->selection.rect = (rect_t){ 0, 0, state->image->width, state->image->height };
+        state->selection.active = true;
+    }
+    if(input_key_pressed(in, INPUT_KEY_DELETE) && state->selection.active) {
+        selection_commit(state);
+        edit_fill(state, state->selection.rect, WHITE);
+    }
 }
 
-state_t* init(void) {
+// Headless sessions (replays without a window) skip everything raylib owns
+state_t* init(bool window) {
     state_t* state = make(state_t);
 
-    SetConfigFlags(FLAG_WINDOW_RESIZABLE);
-    InitWindow(INITIAL_WIDTH, INITIAL_HEIGHT, "Prism | PPM Image Editor");
-    SetWindowMonitor(1);
+    state->width = INITIAL_WIDTH;
+    state->height = INITIAL_HEIGHT;
+
+    if(window) {
+        SetConfigFlags(FLAG_WINDOW_RESIZABLE);
+        InitWindow(INITIAL_WIDTH, INITIAL_HEIGHT, "Prism | PPM Image Editor");
+        SetWindowMonitor(1);
 
-    state->monitor_id = GetCurrentMonitor();
+        state->monitor_id = GetCurrentMonitor();
 
-    state->width = GetRenderWidth();
-    state->height = GetRenderHeight();
-    state->target_fps = GetMonitorRefreshRate(state->monitor_id);
+        state->width = GetRenderWidth();
+        state->height = GetRenderHeight();
+        state->target_fps = GetMonitorRefreshRate(state->monitor_id);
 
-    SetTargetFPS(state->target_fps);
+        SetTargetFPS(state->target_fps);
 
-    GuiLoadStyleDefault();
-    GuiSetStyle(DEFAULT, TEXT_SIZE, 20);
+        GuiLoadStyleDefault();
+        GuiSetStyle(DEFAULT, TEXT_SIZE, 20);
 
-    state->clear_color = GetColor(GuiGetStyle(DEFAULT, BACKGROUND_COLOR));
-    state->text_color = GetColor(GuiGetStyle(DEFAULT, TEXT_COLOR_NORMAL));
-    state->default_font = GuiGetFont();
+        state->clear_color = GetColor(GuiGetStyle(DEFAULT, BACKGROUND_COLOR));
+        state->text_color = GetColor(GuiGetStyle(DEFAULT, TEXT_COLOR_NORMAL));
+        state->default_font = GuiGetFont();
+    }
 
     state->mode = MODE_CREATE_IMAGE;
     state->image = NULL;
@@ -317,12 +681,28 @@ state_t* init(void) {
     state->brush_color = BLACK;
     state->focused_textbox = -1;
     state->current_tool = TOOL_BRUSH;
-    state->brush_radius = 5;
+    brush_init(&state->brush, 5);
+    state->stroking = false;
+    state->compare = (compare_t){ 0 };
+    state->comparing = false;
+    state->show_heatmap = true;
+    state->stats = (stats_t){ 0 };
+    state->show_stats = false;
+    state->indexed_storage = false;
+    state->docs = (documents_t){ .active = -1, .budget = DEFAULT_MEMORY_BUDGET };
+    state->selection = (selection_t){ 0 };
+    state->clipboard = NULL;
     state->color_picker_active = false;
     state->color_r = 0;
     state->color_g = 0;
     state->color_b = 0;
     state->current_filepath[0] = '\0';
+    state->input = (input_t){ .width = state->width, .height = state->height };
+    state->recorder = NULL;
+    state->replaying = false;
+    state->single_document = false;
+    state->browser = (browser_t){ 0 };
+    state->browser_action = ACTION_NONE;
 
     snprintf(state->image_width_str, sizeof(state->image_width_str), "512");
     snprintf(state->image_height_str, sizeof(state->image_height_str), "512");
@@ -332,43 +712,77 @@ state_t* init(void) {
     return state;
 }
 
+// Reads only state->input, never the window, so recorded sessions replay identically
 void update(state_t* state) {
+    const input_t* in = &state->input;
+
     // Handle window resize
-    state->width = GetRenderWidth();
-    state->height = GetRenderHeight();
+    state->width = in->width;
+    state->height = in->height;
 
     if(state->mode == MODE_EDITING && state->image) {
+        bool space = input_key_down(in, INPUT_KEY_SPACE);
+
         // Zoom with mouse wheel
-        state->zoom += GetMouseWheelMove() * 0.1f;
+        state->zoom += in->wheel * 0.1f;
         if(state->zoom < 0.1f) state->zoom = 0.1f;
         if(state->zoom > 10.0f) state->zoom = 10.0f;
 
         // Pan with middle mouse button or space + drag
-        if(IsMouseButtonDown(MOUSE_BUTTON_MIDDLE) || (IsKeyDown(KEY_SPACE) && IsMouseButtonDown(MOUSE_BUTTON_LEFT))) {
-            state->pan_x += GetMouseDelta().x;
-            state->pan_y += GetMouseDelta().y;
+        if(input_down(in, INPUT_MOUSE_MIDDLE) || (space && input_down(in, INPUT_MOUSE_LEFT))) {
+            state->pan_x += in->mouse_delta.x;
+            state->pan_y += in->mouse_delta.y;
         }
 
-        // Paint/Fill with left click
-        if(IsMouseButtonDown(MOUSE_BUTTON_LEFT) && !IsKeyDown(KEY_SPACE)) {
-            Vector2 mouse_pos = GetMousePosition();
+        update_selection_shortcuts(state);
+
+        // Select/move with left drag, unclamped so drags can leave the canvas
+        if(state->current_tool == TOOL_SELECT && !space) {
+            Vector2 mouse_pos = in->mouse;
+            float canvas_x = (mouse_pos.x - state->pan_x) / state->zoom;
+            float canvas_y = (mouse_pos.y - state->pan_y) / state->zoom;
+            update_selection_tool(state, (int)canvas_x, (int)canvas_y);
+        }
+
+        // Paint/Fill with left click, into a private copy if the image is shared
+        if(input_down(in, INPUT_MOUSE_LEFT) && !space && state->current_tool != TOOL_SELECT && ensure_writable(state)) {
+            Vector2 mouse_pos = in->mouse;
             float canvas_x = (mouse_pos.x - state->pan_x) / state->zoom;
             float canvas_y = (mouse_pos.y - state->pan_y) / state->zoom;
 
             int px = (int)canvas_x;
             int py = (int)canvas_y;
 
-            if(px >= 0 && px < (int)state->image->width && py >= 0 && py < (int)state->image->height) {
+            if(state->current_tool == TOOL_BRUSH && state->stroking) {
+                // Continue the stroke, stamps are spaced along the drag instead of
+                // repeating every frame so soft/translucent brushes don't saturate
+                brush_stroke(state->image, &state->brush, &state->stats, &state->stroke_x, &state->stroke_y, px, py, state->brush_color);
+            } else if(px >= 0 && px < (int)state->image->width && py >= 0 && py < (int)state->image->height) {
                 if(state->current_tool == TOOL_BRUSH) {
-                    paint_brush(state->image, px, py, state->brush_color, state->brush_radius);
+                    rect_t bounds = brush_stamp_bounds(state->image, &state->brush, px, py);
+                    stats_remove_region(&state->stats, state->image, bounds);
+                    brush_stamp(state->image, &state->brush, px, py, state->brush_color);
+                    stats_add_region(&state->stats, state->image, bounds);
+                    state->stroking = true;
+                    state->stroke_x = px;
+                    state->stroke_y = py;
                 } else if(state->current_tool == TOOL_FILL) {
-                    flood_fill(state->image, px, py, state->brush_color);
+                    // Every filled pixel had the seed's color, so the counts move in one step
+                    Color old_color = ppm_pixel(state->image, (ulong)py * state->image->width + px);
+                    ulong filled = 0;
+                    flood_fill(state->image, px, py, state->brush_color, &filled);
+                    stats_replace_color(&state->stats, old_color, state->brush_color, filled);
                 }
             }
+        } else {
+            state->stroking = false;
         }
 
         // Update brush color from RGB sliders
         state->brush_color = (Color){ state->color_r, state->color_g, state->color_b, 255 };
+
+        // The next stamp would only cancel a restart, wait for the button to come up
+        if(!state->stats.stale || !input_down(in, INPUT_MOUSE_LEFT)) stats_poll(&state->stats, state->image);
     }
 }
 
@@ -397,43 +811,92 @@ void draw_create_image_dialog(state_t* state) {
     }
 
     if(GuiButton((Rectangle) { dialog_x + 300, dialog_y + 75, 150, 95 }, "Create New")) {
-        uint width = atoi(state->image_width_str);
-        uint height = atoi(state->image_height_str);
-        uint max_color = atoi(state->max_color_str);
-
-        if(width > 0 && height > 0 && max_color > 0 && max_color <= 65535) {
-            state->image = create_ppm_image(width, height, max_color);
-            if(state->image) {
-                state->mode = MODE_EDITING;
-                calculate_zoom_to_fit(state);
-                state->current_filepath[0] = '\0';
-                log("Created %ux%u PPM image with max color %u", width, height, max_color);
-            }
-        } else {
-            error("Invalid parameters");
-        }
+        dispatch(state, (action_t){ ACTION_NEW_IMAGE, { atoi(state->image_width_str), atoi(state->image_height_str), atoi(state->max_color_str) } });
     }
 
     // Open section
     GuiLabel((Rectangle) { dialog_x + 20, dialog_y + 260, 200, 20 }, "Or Open File:");
 
     if(GuiButton((Rectangle) { dialog_x + 130, dialog_y + 300, 150, 30 }, "Open File...")) {
-        if(file_dialog_open(state->open_filepath_str, sizeof(state->open_filepath_str))) {
-            ppm_image_t* loaded = load_ppm_image(state->open_filepath_str);
-            if(loaded) {
-                if(state->image) {
-                    free(state->image->pixels);
-                    free(state->image);
-                }
-                state->image = loaded;
-                state->mode = MODE_EDITING;
-                calculate_zoom_to_fit(state);
-                snprintf(state->current_filepath, sizeof(state->current_filepath), "%s", state->open_filepath_str);
-            } else {
-                error("Failed to load PPM file");
-            }
+        browse(state, BROWSER_OPEN, ACTION_OPEN);
+    }
+
+    // Back to the open documents without adding one
+    if(state->docs.count > 0 && GuiButton((Rectangle) { dialog_x + 300, dialog_y + 300, 150, 30 }, "Cancel")) {
+        dispatch(state, (action_t){ ACTION_SWITCH_TAB, { documents_recent(&state->docs) } });
+    }
+}
+
+// One tab per open document with its close button, then duplicate and memory use
+void draw_document_tabs(state_t* state, int y) {
+    documents_t* docs = &state->docs;
+    int tab_width = (state->width - 300) / docs->count;
+    if(tab_width > 160) tab_width = 160;
+    if(tab_width < 50) tab_width = 50;
+
+    int x = 10;
+    for(int i = 0; i < docs->count; i++) {
+        bool active = i == docs->active;
+        const char* name = document_name(active ? state->current_filepath : docs->items[i].filepath);
+        if(GuiButton((Rectangle) { x, y, tab_width - 25, 25 }, TextFormat(active ? "[%.12s]" : "%.14s", name))) {
+            dispatch(state, (action_t){ ACTION_SWITCH_TAB, { i } });
+            return;
+        }
+        if(GuiButton((Rectangle) { x + tab_width - 25, y, 20, 25 }, "x")) {
+            dispatch(state, (action_t){ ACTION_CLOSE_IMAGE, { i } });
+            return;
+        }
+        x += tab_width;
+    }
+
+    if(GuiButton((Rectangle) { x, y, 50, 25 }, "Dup")) {
+        dispatch(state, (action_t){ ACTION_DUPLICATE });
+        return;
+    }
+
+    document_sync(state);
+    GuiLabel((Rectangle) { x + 60, y, 200, 25 }, TextFormat("Memory: %lu / %lu MB", documents_memory(docs) >> 20, docs->budget >> 20));
+}
+
+void draw_stats_panel(state_t* state) {
+    stats_t* stats = &state->stats;
+    int panel_x = state->width - 280;
+    int panel_y = 60;
+    if(!stats->valid) {
+        if(stats->task || stats->stale) GuiLabel((Rectangle) { panel_x + 7, panel_y + 5, 260, 20 }, "Computing statistics...");
+        return;
+    }
+
+    int hist_height = 100;
+    DrawRectangle(panel_x, panel_y, 270, 215, Fade(state->clear_color, 0.9f));
+    DrawRectangleLines(panel_x, panel_y, 270, 215, state->text_color);
+
+    // Scale every channel by the tallest bin so they share one axis
+    ulong peak = 1;
+    for(int ch = 0; ch < 3; ch++) {
+        for(int v = 0; v < 256; v++) {
+            if(stats->hist[ch][v] > peak) peak = stats->hist[ch][v];
+        }
+    }
+
+    Color channel_colors[3] = { Fade(RED, 0.5f), Fade(GREEN, 0.5f), Fade(BLUE, 0.5f) };
+    int hist_x = panel_x + 7;
+    int hist_y = panel_y + 10 + hist_height;
+    for(int ch = 0; ch < 3; ch++) {
+        for(int v = 0; v < 256; v++) {
+            int h = (int)((double)stats->hist[ch][v] / peak * hist_height + 0.5);
+            if(h > 0) DrawRectangle(hist_x + v, hist_y - h, 1, h, channel_colors[ch]);
         }
     }
+
+    GuiLabel((Rectangle) { panel_x + 7, hist_y + 5, 260, 20 }, TextFormat("Unique colors: %lu", stats->unique_colors));
+
+    const char* names[3] = { "R", "G", "B" };
+    for(int ch = 0; ch < 3; ch++) {
+        double mean, stddev;
+        stats_channel(stats, ch, &mean, &stddev);
+        GuiLabel((Rectangle) { panel_x + 7, hist_y + 27 + ch * 22, 260, 20 }, TextFormat("%s: mean %.1f, sd %.1f", names[ch], mean, stddev));
+    }
 }
 
 void draw_editing_canvas(state_t* state) {
@@ -448,85 +911,172 @@ void draw_editing_canvas(state_t* state) {
             // Add 1 pixel to prevent gaps between rectangles
             float size = state->zoom + 1.0f;
             DrawRectangle((int)screen_x, (int)screen_y, (int)size, (int)size,
-                state->image->pixels[y * state->image->width + x]);
+                ppm_pixel(state->image, (ulong)y * state->image->width + x));
+        }
+    }
+
+    // Selection being moved, drawn on top of the hole it was lifted from
+    selection_t* sel = &state->selection;
+    if(sel->floating) {
+        for(uint y = 0; y < sel->floating->height; y++) {
+            for(uint x = 0; x < sel->floating->width; x++) {
+                float screen_x = state->pan_x + (sel->rect.x + (int)x) * state->zoom;
+                float screen_y = state->pan_y + (sel->rect.y + (int)y) * state->zoom;
+                float size = state->zoom + 1.0f;
+                DrawRectangle((int)screen_x, (int)screen_y, (int)size, (int)size,
+                    sel->floating->pixels[y * sel->floating->width + x]);
+            }
+        }
+    }
+
+    if(state->comparing) {
+        compare_t* c = &state->compare;
+        if(state->show_heatmap && c->heatmap) {
+            for(uint y = 0; y < c->height; y++) {
+                for(uint x = 0; x < c->width; x++) {
+                    Color h = c->heatmap->pixels[y * c->width + x];
+                    if(h.a == 0) continue;
+                    float screen_x = state->pan_x + x * state->zoom;
+                    float screen_y = state->pan_y + y * state->zoom;
+                    float size = state->zoom + 1.0f;
+                    DrawRectangle((int)screen_x, (int)screen_y, (int)size, (int)size, h);
+                }
+            }
+        }
+
+        for(int i = 0; i < c->region_count; i++) {
+            rect_t r = c->regions[i];
+            DrawRectangleLines((int)(state->pan_x + r.x * state->zoom), (int)(state->pan_y + r.y * state->zoom),
+                (int)(r.width * state->zoom) + 1, (int)(r.height * state->zoom) + 1, RED);
         }
     }
 
+    if(sel->active || sel->floating) {
+        DrawRectangleLines((int)(state->pan_x + sel->rect.x * state->zoom), (int)(state->pan_y + sel->rect.y * state->zoom),
+            (int)(sel->rect.width * state->zoom), (int)(sel->rect.height * state->zoom), SKYBLUE);
+    }
+
     // Top toolbar
     int toolbar_y = 10;
-    GuiLabel((Rectangle) { 10, toolbar_y, 200, 20 }, TextFormat("Image: %ux%u", state->image->width, state->image->height));
+    if(ppm_indexed(state->image)) {
+        GuiLabel((Rectangle) { 10, toolbar_y, 200, 20 }, TextFormat("Image: %ux%u, palette %u", state->image->width, state->image->height, state->image->palette_size));
+    } else {
+        GuiLabel((Rectangle) { 10, toolbar_y, 200, 20 }, TextFormat("Image: %ux%u", state->image->width, state->image->height));
+    }
     GuiLabel((Rectangle) { 10, toolbar_y + 25, 200, 20 }, TextFormat("Zoom: %.1fx", state->zoom));
 
     int button_x = 220;
     if(GuiButton((Rectangle) { button_x, toolbar_y, 70, 30 }, "New")) {
-        free(state->image->pixels);
-        free(state->image);
-        state->image = NULL;
-        state->mode = MODE_CREATE_IMAGE;
-        state->current_filepath[0] = '\0';
+        dispatch(state, (action_t){ ACTION_NEW_TAB });
     }
     button_x += 75;
 
     if(GuiButton((Rectangle) { button_x, toolbar_y, 70, 30 }, "Open")) {
-        char filepath[256];
-        if(file_dialog_open(filepath, sizeof(filepath))) {
-            ppm_image_t* loaded = load_ppm_image(filepath);
-            if(loaded) {
-                if(state->image) {
-                    free(state->image->pixels);
-                    free(state->image);
-                }
-                state->image = loaded;
-                snprintf(state->current_filepath, sizeof(state->current_filepath), "%s", filepath);
-                calculate_zoom_to_fit(state);
-                log("Opened file: %s", filepath);
-            } else {
-                error("Failed to load PPM file");
-            }
-        }
+        browse(state, BROWSER_OPEN, ACTION_OPEN);
     }
     button_x += 75;
 
     if(GuiButton((Rectangle) { button_x, toolbar_y, 70, 30 }, "Save")) {
-        char filepath[256];
+        action_t save = { ACTION_SAVE };
         if(state->current_filepath[0] != '\0') {
             // Save to current file
-            if(save_ppm_image(state->image, state->current_filepath)) {
-                log("Saved to: %s", state->current_filepath);
-            }
+            snprintf(save.path, sizeof(save.path), "%s", state->current_filepath);
+            dispatch(state, save);
         } else {
-            // Open save dialog
-            if(file_dialog_save(filepath, sizeof(filepath))) {
-                if(save_ppm_image(state->image, filepath)) {
-                    snprintf(state->current_filepath, sizeof(state->current_filepath), "%s", filepath);
-                    log("Saved to: %s", filepath);
-                }
-            }
+            browse(state, BROWSER_SAVE, ACTION_SAVE);
         }
     }
     button_x += 75;
 
+    if(GuiButton((Rectangle) { button_x, toolbar_y, 90, 30 }, "Compare")) {
+        browse(state, BROWSER_OPEN, ACTION_COMPARE);
+    }
+    button_x += 95;
+
+    if(GuiButton((Rectangle) { button_x, toolbar_y, 70, 30 }, state->show_stats ? "[Stats]" : "Stats")) {
+        dispatch(state, (action_t){ ACTION_TOGGLE_STATS });
+    }
+    button_x += 75;
+
+    if(GuiButton((Rectangle) { button_x, toolbar_y, 90, 30 }, state->indexed_storage ? "[Indexed]" : "Indexed")) {
+        dispatch(state, (action_t){ ACTION_TOGGLE_INDEXED });
+    }
+    button_x += 95;
+
     GuiLabel((Rectangle) { button_x, toolbar_y, 300, 20 }, TextFormat("File: %s", state->current_filepath[0] ? state->current_filepath : "[Untitled]"));
 
+    // Comparison summary under the toolbar
+    if(state->comparing) {
+        compare_t* c = &state->compare;
+        const char* psnr = c->sum_sq ? TextFormat("%.2f", c->psnr) : "inf";
+        GuiLabel((Rectangle) { 220, toolbar_y + 35, 520, 20 }, TextFormat("Diff: %lu px, max %u, PSNR %s dB, %d regions",
+            c->changed_pixels, c->max_error, psnr, c->region_count));
+        // The memory budget may have evicted it while the tab was parked
+        if(!c->heatmap) {
+            GuiLabel((Rectangle) { 745, toolbar_y + 35, 90, 20 }, "No heatmap");
+        } else if(GuiButton((Rectangle) { 745, toolbar_y + 35, 90, 20 }, state->show_heatmap ? "[Heatmap]" : "Heatmap")) {
+            dispatch(state, (action_t){ ACTION_TOGGLE_HEATMAP });
+        }
+        if(GuiButton((Rectangle) { 840, toolbar_y + 35, 70, 20 }, "Close")) {
+            dispatch(state, (action_t){ ACTION_COMPARE_CLOSE });
+        }
+    }
+
+    draw_document_tabs(state, state->height - 185);
+
     // Tool selection panel - bottom left
     int tool_panel_y = state->height - 150;
     GuiLabel((Rectangle) { 10, tool_panel_y, 100, 20 }, "Tools:");
 
     if(GuiButton((Rectangle) { 10, tool_panel_y + 25, 70, 25 }, state->current_tool == TOOL_BRUSH ? "[Brush]" : "Brush")) {
-        state->current_tool = TOOL_BRUSH;
+        dispatch(state, (action_t){ ACTION_TOOL, { TOOL_BRUSH } });
     }
     if(GuiButton((Rectangle) { 85, tool_panel_y + 25, 70, 25 }, state->current_tool == TOOL_FILL ? "[Fill]" : "Fill")) {
-        state->current_tool = TOOL_FILL;
+        dispatch(state, (action_t){ ACTION_TOOL, { TOOL_FILL } });
+    }
+    if(GuiButton((Rectangle) { 160, tool_panel_y + 25, 70, 25 }, state->current_tool == TOOL_SELECT ? "[Select]" : "Select")) {
+        dispatch(state, (action_t){ ACTION_TOOL, { TOOL_SELECT } });
     }
 
     // Brush radius slider (only for brush tool)
     if(state->current_tool == TOOL_BRUSH) {
-        GuiLabel((Rectangle) { 10, tool_panel_y + 55, 150, 20 }, TextFormat("Radius: %d", state->brush_radius));
-        float radius_f = state->brush_radius;
-        GuiSlider((Rectangle) { 10, tool_panel_y + 75, 150, 20 }, "", "", & radius_f, 1, 50);
-        state->brush_radius = (int)radius_f;
+        GuiLabel((Rectangle) { 10, tool_panel_y + 55, 150, 20 }, TextFormat("Radius: %d", state->brush.radius));
+        float radius_f = state->brush.radius;
+        GuiSlider((Rectangle) { 10, tool_panel_y + 75, 150, 20 }, "", "", & radius_f, BRUSH_RADIUS_MIN, BRUSH_RADIUS_MAX);
+        if((int)radius_f != state->brush.radius) dispatch(state, (action_t){ ACTION_BRUSH_RADIUS, { (int)radius_f } });
+
+        GuiLabel((Rectangle) { 170, tool_panel_y + 55, 150, 20 }, TextFormat("Hardness: %d%%", (int)(state->brush.hardness * 100.0f + 0.5f)));
+        float hardness = state->brush.hardness;
+        GuiSlider((Rectangle) { 170, tool_panel_y + 75, 150, 20 }, "", "", & hardness, 0.0f, 1.0f);
+        if(hardness != state->brush.hardness) dispatch(state, (action_t){ ACTION_BRUSH_HARDNESS, .value = hardness });
+
+        GuiLabel((Rectangle) { 330, tool_panel_y + 55, 150, 20 }, TextFormat("Opacity: %d%%", (int)(state->brush.opacity * 100.0f + 0.5f)));
+        float opacity = state->brush.opacity;
+        GuiSlider((Rectangle) { 330, tool_panel_y + 75, 150, 20 }, "", "", & opacity, 0.0f, 1.0f);
+        if(opacity != state->brush.opacity) dispatch(state, (action_t){ ACTION_BRUSH_OPACITY, .value = opacity });
+
+        if(GuiButton((Rectangle) { 10, tool_panel_y + 105, 150, 25 }, TextFormat("Mode: %s", blend_mode_name(state->brush.mode)))) {
+            dispatch(state, (action_t){ ACTION_BRUSH_MODE, { (state->brush.mode + 1) % BLEND_MODE_COUNT } });
+        }
     }
 
+    // Selection actions (only for select tool), act on the whole image without a selection
+    if(state->current_tool == TOOL_SELECT) {
+        int action_y = tool_panel_y + 55;
+        if(GuiButton((Rectangle) { 10, action_y, 70, 25 }, "Copy")) dispatch(state, (action_t){ ACTION_COPY });
+        if(GuiButton((Rectangle) { 85, action_y, 70, 25 }, "Cut")) dispatch(state, (action_t){ ACTION_CUT });
+        if(GuiButton((Rectangle) { 160, action_y, 70, 25 }, "Paste")) dispatch(state, (action_t){ ACTION_PASTE });
+        if(GuiButton((Rectangle) { 235, action_y, 70, 25 }, "Crop")) dispatch(state, (action_t){ ACTION_CROP });
+
+        action_y += 30;
+        if(GuiButton((Rectangle) { 10, action_y, 70, 25 }, "Flip H")) dispatch(state, (action_t){ ACTION_FLIP, { true } });
+        if(GuiButton((Rectangle) { 85, action_y, 70, 25 }, "Flip V")) dispatch(state, (action_t){ ACTION_FLIP, { false } });
+        if(GuiButton((Rectangle) { 160, action_y, 70, 25 }, "Rot CW")) dispatch(state, (action_t){ ACTION_ROTATE, { true } });
+        if(GuiButton((Rectangle) { 235, action_y, 70, 25 }, "Rot CCW")) dispatch(state, (action_t){ ACTION_ROTATE, { false } });
+    }
+
+    if(state->show_stats) draw_stats_panel(state);
+
     // Color picker - bottom right
     if(GuiButton((Rectangle) { state->width - 240, tool_panel_y, 50, 40 }, "Color")) {
         state->color_picker_active = !state->color_picker_active;
@@ -542,36 +1092,175 @@ void draw_editing_canvas(state_t* state) {
         GuiLabel((Rectangle) { state->width - 240, picker_y, 100, 20 }, "Red:");
         float r_f = state->color_r;
         GuiSlider((Rectangle) { state->width - 240, picker_y + 20, 230, 20 }, "", "", & r_f, 0, 255);
-        state->color_r = (int)r_f;
 
         GuiLabel((Rectangle) { state->width - 240, picker_y + 45, 100, 20 }, "Green:");
         float g_f = state->color_g;
         GuiSlider((Rectangle) { state->width - 240, picker_y + 65, 230, 20 }, "", "", & g_f, 0, 255);
-        state->color_g = (int)g_f;
 
         GuiLabel((Rectangle) { state->width - 240, picker_y + 90, 100, 20 }, "Blue:");
         float b_f = state->color_b;
         GuiSlider((Rectangle) { state->width - 240, picker_y + 110, 230, 20 }, "", "", & b_f, 0, 255);
-        state->color_b = (int)b_f;
+
+        if((int)r_f != state->color_r || (int)g_f != state->color_g || (int)b_f != state->color_b) {
+            dispatch(state, (action_t){ ACTION_COLOR, { (int)r_f, (int)g_f, (int)b_f } });
+        }
     }
 }
 
 void draw(state_t* state) {
     ClearBackground(state->clear_color);
 
+    // The browser is modal, everything under it is drawn but doesn't react
+    bool browsing = state->browser.visible;
+    if(browsing) GuiLock();
+
     if(state->mode == MODE_CREATE_IMAGE) {
         draw_create_image_dialog(state);
     } else if(state->mode == MODE_EDITING) {
         draw_editing_canvas(state);
     }
+
+    if(browsing) {
+        GuiUnlock();
+        action_t picked = { state->browser_action };
+        if(browser_draw(&state->browser, state->width, state->height, picked.path, sizeof(picked.path))) {
+            if(picked.type == ACTION_OPEN) snprintf(state->open_filepath_str, sizeof(state->open_filepath_str), "%s", picked.path);
+            dispatch(state, picked);
+        }
+    }
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [--record <session.rec>] [--memory-budget <MB>]\n", argv0);
+    fprintf(stderr, "       %s --replay <session.rec> [--headless] [--timings <frames.csv>] [--memory-budget <MB>]\n", argv0);
+    fprintf(stderr, "       %s --compare <a.ppm> <b.ppm> [--tolerance <n>] [--heatmap <out.ppm>]\n", argv0);
+}
+
+// Headless comparison for scripted regression checks, exits 0 when identical,
+// 1 when the images differ and 2 on errors
+int run_compare(int argc, char** argv) {
+    if(argc < 4) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    uint tolerance = 0;
+    const char* heatmap_path = NULL;
+    for(int i = 4; i < argc; i++) {
+        if(smatch(argv[i], "--tolerance") && i + 1 < argc) {
+            tolerance = atoi(argv[++i]);
+        } else if(smatch(argv[i], "--heatmap") && i + 1 < argc) {
+            heatmap_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    return compare_files(argv[2], argv[3], tolerance, heatmap_path);
 }
 
-int main(void) {
-    state_t* state = init();
+// Replays a recorded session as fast as it will go and reports the time each
+// frame spent in update() and draw(). Headless replays have no GL context, so
+// only update() runs; exits 0 on success and 2 when the recording is unusable
+int run_replay(const char* path, bool headless, const char* timings_path, ulong memory_budget) {
+    replay_t replay;
+    if(!replay_open(&replay, path)) return 2;
+
+    state_t* state = init(!headless);
+    state->docs.budget = memory_budget;
+    state->replaying = true;
+    state->single_document = replay.version == 1;
+    if(!headless) {
+        SetTargetFPS(0);
+        GuiLock();
+    }
+
+    frame_timings_t timings = { 0 };
+    while(replay_next_frame(&replay)) {
+        if(!headless && WindowShouldClose()) break;
+
+        state->input = replay.input;
+        if(!headless && (state->input.width != state->width || state->input.height != state->height)) {
+            SetWindowSize(state->input.width, state->input.height);
+        }
+
+        // Recorded actions were taken while drawing, after update() in the same frame
+        if(!headless) BeginDrawing();
+        double start = time_ms();
+        update(state);
+        for(int i = 0; i < replay.action_count; i++) {
+            apply_action(state, &replay.actions[i]);
+        }
+        double updated = time_ms();
+        if(!headless) draw(state);
+        double drawn = time_ms();
+        if(!headless) EndDrawing();
+
+        timings_add(&timings, updated - start, drawn - updated);
+    }
+
+    int status = replay.corrupt ? 2 : 0;
+    replay_close(&replay);
+
+    timings_report(&timings, !headless);
+    if(state->image) {
+        printf("image: %ux%u, hash %016lx\n", state->image->width, state->image->height, hash_ppm_image(state->image));
+    }
+    if(timings_path && !timings_write_csv(&timings, timings_path)) status = 2;
+
+    timings_free(&timings);
+    free_state(state);
+    if(!headless) CloseWindow();
+    return status;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1 && smatch(argv[1], "--compare")) return run_compare(argc, argv);
+
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    const char* timings_path = NULL;
+    bool headless = false;
+    ulong memory_budget = DEFAULT_MEMORY_BUDGET;
+    for(int i = 1; i < argc; i++) {
+        if(smatch(argv[i], "--record") && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if(smatch(argv[i], "--replay") && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if(smatch(argv[i], "--timings") && i + 1 < argc) {
+            timings_path = argv[++i];
+        } else if(smatch(argv[i], "--memory-budget") && i + 1 < argc) {
+            memory_budget = strtoul(argv[++i], NULL, 10) << 20;
+        } else if(smatch(argv[i], "--headless")) {
+            headless = true;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if(replay_path && !record_path) return run_replay(replay_path, headless, timings_path, memory_budget);
+    if(replay_path || headless || timings_path) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    recorder_t recorder;
+    if(record_path && !recorder_open(&recorder, record_path)) return 2;
+
+    state_t* state = init(true);
+    state->docs.budget = memory_budget;
+    if(record_path) state->recorder = &recorder;
 
     log("Running at %dx%d@%dhz", state->width, state->height, state->target_fps);
 
     while(!WindowShouldClose()) {
+        // Input is sampled once per frame, the recording stores exactly what update() sees
+        input_poll(&state->input);
+        if(state->browser.visible) input_idle(&state->input);
+        if(state->recorder) recorder_frame(state->recorder, &state->input);
+
         BeginDrawing();
 
         update(state);
@@ -580,9 +1269,13 @@ int main(void) {
         EndDrawing();
     }
 
-    CloseWindow();
+    int status = 0;
+    if(state->recorder && !recorder_close(state->recorder)) status = 1;
 
+    // Frees GPU textures, so the window has to outlive it
     free_state(state);
 
-    return 0;
+    CloseWindow();
+
+    return status;
 }
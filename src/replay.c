@@ -0,0 +1,355 @@
+#include "replay.h"
+#include "stream.h"
+
+#include <string.h>
+#include <time.h>
+
+static const char REPLAY_MAGIC[8] = { 'P', 'R', 'I', 'S', 'M', 'R', 'E', 'C' };
+// Version 2 added document tabs, version 1 recordings are still read and
+// replayed with a single document
+static const unsigned char REPLAY_VERSION = 2;
+
+// Record tags, a frame is followed by the actions taken during it
+enum { RECORD_FRAME = 'F', RECORD_ACTION = 'A' };
+
+// Fields present in a frame record, everything else repeats the last frame
+enum {
+    FIELD_SIZE = 1 << 0,
+    FIELD_MOUSE = 1 << 1,
+    FIELD_WHEEL = 1 << 2,
+    FIELD_BUTTONS = 1 << 3,
+    FIELD_KEYS = 1 << 4,
+};
+
+static const struct { int key; uint bit; } TRACKED_KEYS[] = {
+    { KEY_SPACE, INPUT_KEY_SPACE },
+    { KEY_LEFT_CONTROL, INPUT_KEY_CTRL },
+    { KEY_RIGHT_CONTROL, INPUT_KEY_CTRL },
+    { KEY_A, INPUT_KEY_A },
+    { KEY_C, INPUT_KEY_C },
+    { KEY_D, INPUT_KEY_D },
+    { KEY_V, INPUT_KEY_V },
+    { KEY_X, INPUT_KEY_X },
+    { KEY_DELETE, INPUT_KEY_DELETE },
+};
+
+static const struct { int button; uint bit; } TRACKED_BUTTONS[] = {
+    { MOUSE_BUTTON_LEFT, INPUT_MOUSE_LEFT },
+    { MOUSE_BUTTON_RIGHT, INPUT_MOUSE_RIGHT },
+    { MOUSE_BUTTON_MIDDLE, INPUT_MOUSE_MIDDLE },
+};
+
+void input_poll(input_t* in) {
+    Vector2 previous = in->mouse;
+
+    in->width = GetRenderWidth();
+    in->height = GetRenderHeight();
+    in->mouse = GetMousePosition();
+    in->mouse_delta = (Vector2){ in->mouse.x - previous.x, in->mouse.y - previous.y };
+    in->wheel = GetMouseWheelMove();
+
+    in->buttons_down = in->buttons_pressed = in->buttons_released = 0;
+    for(usize i = 0; i < sizeof(TRACKED_BUTTONS) / sizeof(TRACKED_BUTTONS[0]); i++) {
+        int b = TRACKED_BUTTONS[i].button;
+        if(IsMouseButtonDown(b)) in->buttons_down |= TRACKED_BUTTONS[i].bit;
+        if(IsMouseButtonPressed(b)) in->buttons_pressed |= TRACKED_BUTTONS[i].bit;
+        if(IsMouseButtonReleased(b)) in->buttons_released |= TRACKED_BUTTONS[i].bit;
+    }
+
+    in->keys_down = in->keys_pressed = 0;
+    for(usize i = 0; i < sizeof(TRACKED_KEYS) / sizeof(TRACKED_KEYS[0]); i++) {
+        int k = TRACKED_KEYS[i].key;
+        if(IsKeyDown(k)) in->keys_down |= TRACKED_KEYS[i].bit;
+        if(IsKeyPressed(k)) in->keys_pressed |= TRACKED_KEYS[i].bit;
+    }
+}
+
+static void put_u8(FILE* f, uint v) { fputc(v & 0xff, f); }
+static void put_u16(FILE* f, uint v) { put_u8(f, v); put_u8(f, v >> 8); }
+
+static void put_u32(FILE* f, uint v) {
+    put_u16(f, v & 0xffff);
+    put_u16(f, v >> 16);
+}
+
+static void put_f32(FILE* f, float v) {
+    uint bits;
+    memcpy(&bits, &v, sizeof(bits));
+    put_u32(f, bits);
+}
+
+static bool get_u8(FILE* f, uint* v) {
+    int c = fgetc(f);
+    if(c == EOF) return false;
+    *v = (uint)c;
+    return true;
+}
+
+static bool get_u16(FILE* f, uint* v) {
+    uint lo, hi;
+    if(!get_u8(f, &lo) || !get_u8(f, &hi)) return false;
+    *v = lo | (hi << 8);
+    return true;
+}
+
+static bool get_u32(FILE* f, uint* v) {
+    uint lo, hi;
+    if(!get_u16(f, &lo) || !get_u16(f, &hi)) return false;
+    *v = lo | (hi << 16);
+    return true;
+}
+
+static bool get_i32(FILE* f, int* v) {
+    uint u;
+    if(!get_u32(f, &u)) return false;
+    *v = (int)u;
+    return true;
+}
+
+static bool get_f32(FILE* f, float* v) {
+    uint bits;
+    if(!get_u32(f, &bits)) return false;
+    memcpy(v, &bits, sizeof(*v));
+    return true;
+}
+
+bool recorder_open(recorder_t* rec, const char* path) {
+    *rec = (recorder_t){ 0 };
+    rec->f = stream_open_write(path);
+    if(!rec->f) {
+        error("Unable to open recording %s", path);
+        return false;
+    }
+
+    fwrite(REPLAY_MAGIC, 1, sizeof(REPLAY_MAGIC), rec->f);
+    put_u8(rec->f, REPLAY_VERSION);
+    return true;
+}
+
+void recorder_frame(recorder_t* rec, const input_t* in) {
+    if(!rec->f) return;
+    const input_t* last = &rec->last;
+
+    // Idle frames cost two bytes, a mouse drag ten
+    uint fields = 0;
+    if(rec->frames == 0 || in->width != last->width || in->height != last->height) fields |= FIELD_SIZE;
+    if(in->mouse.x != last->mouse.x || in->mouse.y != last->mouse.y) fields |= FIELD_MOUSE;
+    if(in->wheel != last->wheel) fields |= FIELD_WHEEL;
+    if(in->buttons_down != last->buttons_down || in->buttons_pressed != last->buttons_pressed || in->buttons_released != last->buttons_released) {
+        fields |= FIELD_BUTTONS;
+    }
+    if(in->keys_down != last->keys_down || in->keys_pressed != last->keys_pressed) fields |= FIELD_KEYS;
+
+    put_u8(rec->f, RECORD_FRAME);
+    put_u8(rec->f, fields);
+    if(fields & FIELD_SIZE) {
+        put_u32(rec->f, (uint)in->width);
+        put_u32(rec->f, (uint)in->height);
+    }
+    if(fields & FIELD_MOUSE) {
+        put_f32(rec->f, in->mouse.x);
+        put_f32(rec->f, in->mouse.y);
+    }
+    if(fields & FIELD_WHEEL) put_f32(rec->f, in->wheel);
+    if(fields & FIELD_BUTTONS) {
+        put_u8(rec->f, in->buttons_down);
+        put_u8(rec->f, in->buttons_pressed);
+        put_u8(rec->f, in->buttons_released);
+    }
+    if(fields & FIELD_KEYS) {
+        put_u8(rec->f, in->keys_down);
+        put_u8(rec->f, in->keys_pressed);
+    }
+
+    rec->last = *in;
+    rec->frames++;
+}
+
+void recorder_action(recorder_t* rec, const action_t* action) {
+    if(!rec->f) return;
+
+    usize len = strnlen(action->path, sizeof(action->path) - 1);
+    put_u8(rec->f, RECORD_ACTION);
+    put_u8(rec->f, action->type);
+    for(int i = 0; i < 3; i++) {
+        put_u32(rec->f, (uint)action->args[i]);
+    }
+    put_f32(rec->f, action->value);
+    put_u16(rec->f, len);
+    fwrite(action->path, 1, len, rec->f);
+    rec->actions++;
+}
+
+bool recorder_close(recorder_t* rec) {
+    if(!rec->f) return false;
+    bool ok = !ferror(rec->f);
+    if(fclose(rec->f) != 0) ok = false;
+    rec->f = NULL;
+
+    if(!ok) {
+        error("Failed to write recording");
+        return false;
+    }
+    log("Recorded %lu frames, %lu actions", rec->frames, rec->actions);
+    return true;
+}
+
+bool replay_open(replay_t* rp, const char* path) {
+    *rp = (replay_t){ 0 };
+    rp->f = stream_open_read(path);
+    if(!rp->f) {
+        error("Unable to open recording %s", path);
+        return false;
+    }
+
+    char magic[sizeof(REPLAY_MAGIC)];
+    if(fread(magic, 1, sizeof(magic), rp->f) != sizeof(magic) || memcmp(magic, REPLAY_MAGIC, sizeof(magic)) != 0 ||
+        !get_u8(rp->f, &rp->version) || rp->version < 1 || rp->version > REPLAY_VERSION) {
+        error("%s is not a Prism recording", path);
+        replay_close(rp);
+        return false;
+    }
+    return true;
+}
+
+static bool read_action(FILE* f, uint version, action_t* action) {
+    uint type, len;
+    *action = (action_t){ 0 };
+    uint count = version == 1 ? ACTION_NEW_TAB : ACTION_COUNT;
+    if(!get_u8(f, &type) || type >= count) return false;
+    action->type = type;
+    for(int i = 0; i < 3; i++) {
+        if(!get_i32(f, &action->args[i])) return false;
+    }
+    if(!get_f32(f, &action->value) || !get_u16(f, &len)) return false;
+    if(len >= sizeof(action->path)) return false;
+    if(fread(action->path, 1, len, f) != len) return false;
+    action->path[len] = '\0';
+    return true;
+}
+
+// Advance to the next frame, leaving its input in rp->input and the actions
+// taken during it in rp->actions. False at the end of the recording
+bool replay_next_frame(replay_t* rp) {
+    if(!rp->f) return false;
+
+    uint tag, fields;
+    if(!get_u8(rp->f, &tag)) return false;
+    if(tag != RECORD_FRAME || !get_u8(rp->f, &fields)) goto corrupt;
+
+    input_t* in = &rp->input;
+    Vector2 previous = in->mouse;
+    if(fields & FIELD_SIZE) {
+        if(!get_i32(rp->f, &in->width) || !get_i32(rp->f, &in->height)) goto corrupt;
+    }
+    if(fields & FIELD_MOUSE) {
+        if(!get_f32(rp->f, &in->mouse.x) || !get_f32(rp->f, &in->mouse.y)) goto corrupt;
+    }
+    if(fields & FIELD_WHEEL) {
+        if(!get_f32(rp->f, &in->wheel)) goto corrupt;
+    }
+    if(fields & FIELD_BUTTONS) {
+        if(!get_u8(rp->f, &in->buttons_down) || !get_u8(rp->f, &in->buttons_pressed) || !get_u8(rp->f, &in->buttons_released)) goto corrupt;
+    }
+    if(fields & FIELD_KEYS) {
+        if(!get_u8(rp->f, &in->keys_down) || !get_u8(rp->f, &in->keys_pressed)) goto corrupt;
+    }
+    in->mouse_delta = (Vector2){ in->mouse.x - previous.x, in->mouse.y - previous.y };
+
+    rp->action_count = 0;
+    int c;
+    while((c = fgetc(rp->f)) == RECORD_ACTION) {
+        if(rp->action_count == REPLAY_MAX_ACTIONS) goto corrupt;
+        if(!read_action(rp->f, rp->version, &rp->actions[rp->action_count])) goto corrupt;
+        rp->action_count++;
+    }
+    if(c != EOF) ungetc(c, rp->f);
+
+    rp->frames++;
+    return true;
+
+corrupt:
+    error("Recording is corrupt after frame %lu", rp->frames);
+    rp->corrupt = true;
+    replay_close(rp);
+    return false;
+}
+
+void replay_close(replay_t* rp) {
+    if(rp->f) fclose(rp->f);
+    rp->f = NULL;
+}
+
+double time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void timings_add(frame_timings_t* t, double update_ms, double draw_ms) {
+    if(t->count == t->capacity) {
+        ulong capacity = t->capacity ? t->capacity * 2 : 1024;
+        double* update = realloc(t->update_ms, capacity * sizeof(double));
+        if(update) t->update_ms = update;
+        double* draw = realloc(t->draw_ms, capacity * sizeof(double));
+        if(draw) t->draw_ms = draw;
+        guardv(update && draw, "Unable to grow frame timings");
+        t->capacity = capacity;
+    }
+    t->update_ms[t->count] = update_ms;
+    t->draw_ms[t->count] = draw_ms;
+    t->count++;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void report_series(const char* name, const double* values, ulong count) {
+    double* sorted = make(double, count);
+    guardv(sorted, "Unable to allocate timing report");
+    memcpy(sorted, values, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+
+    double total = 0.0;
+    for(ulong i = 0; i < count; i++) {
+        total += sorted[i];
+    }
+
+    printf("%s_ms: mean %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f, total %.1f\n", name,
+        total / count, sorted[count / 2], sorted[count * 95 / 100], sorted[count * 99 / 100], sorted[count - 1], total);
+    free(sorted);
+}
+
+void timings_report(const frame_timings_t* t, bool has_draw) {
+    printf("frames: %lu\n", t->count);
+    if(t->count == 0) return;
+    report_series("update", t->update_ms, t->count);
+    if(has_draw) report_series("draw", t->draw_ms, t->count);
+}
+
+bool timings_write_csv(const frame_timings_t* t, const char* path) {
+    FILE* f = fopen(path, "w");
+    if(!f) {
+        error("Unable to open %s for writing", path);
+        return false;
+    }
+
+    fprintf(f, "frame,update_ms,draw_ms\n");
+    for(ulong i = 0; i < t->count; i++) {
+        fprintf(f, "%lu,%.4f,%.4f\n", i, t->update_ms[i], t->draw_ms[i]);
+    }
+
+    bool ok = !ferror(f);
+    if(fclose(f) != 0) ok = false;
+    if(!ok) error("Failed to write %s", path);
+    return ok;
+}
+
+void timings_free(frame_timings_t* t) {
+    free(t->update_ms);
+    free(t->draw_ms);
+    *t = (frame_timings_t){ 0 };
+}
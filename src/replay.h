@@ -0,0 +1,137 @@
+#ifndef PRISM_REPLAY_H
+#define PRISM_REPLAY_H
+
+#include <raylib.h>
+
+#include "utils.h"
+
+// Most actions recorded within a single frame
+#define REPLAY_MAX_ACTIONS 16
+
+typedef enum input_button {
+    INPUT_MOUSE_LEFT = 1 << 0,
+    INPUT_MOUSE_RIGHT = 1 << 1,
+    INPUT_MOUSE_MIDDLE = 1 << 2,
+} input_button_t;
+
+typedef enum input_key {
+    INPUT_KEY_SPACE = 1 << 0,
+    INPUT_KEY_CTRL = 1 << 1,
+    INPUT_KEY_A = 1 << 2,
+    INPUT_KEY_C = 1 << 3,
+    INPUT_KEY_D = 1 << 4,
+    INPUT_KEY_V = 1 << 5,
+    INPUT_KEY_X = 1 << 6,
+    INPUT_KEY_DELETE = 1 << 7,
+} input_key_t;
+
+// Everything update() reads from the window in one frame, polled live or
+// read back from a recording so both paths run the same code
+typedef struct input {
+    int width;
+    int height;
+    Vector2 mouse;
+    Vector2 mouse_delta; // from the previous sample, not the OS, so replays match
+    float wheel;
+    uint buttons_down;
+    uint buttons_pressed;
+    uint buttons_released;
+    uint keys_down;
+    uint keys_pressed;
+} input_t;
+
+// UI decisions that don't come from canvas input, recorded with their
+// results (file paths, slider values) so replays skip the dialogs
+typedef enum action_type {
+    ACTION_NONE,
+    ACTION_NEW_IMAGE,  // args: width, height, max color
+    ACTION_OPEN,       // path
+    ACTION_SAVE,       // path
+    ACTION_CLOSE_IMAGE, // args: document
+    ACTION_COMPARE,    // path
+    ACTION_COMPARE_CLOSE,
+    ACTION_TOGGLE_HEATMAP,
+    ACTION_TOGGLE_STATS,
+    ACTION_TOOL,       // args: tool
+    ACTION_BRUSH_RADIUS,   // args: radius
+    ACTION_BRUSH_HARDNESS, // value
+    ACTION_BRUSH_OPACITY,  // value
+    ACTION_BRUSH_MODE,     // args: mode
+    ACTION_COLOR,      // args: r, g, b
+    ACTION_COPY,
+    ACTION_CUT,
+    ACTION_PASTE,
+    ACTION_CROP,
+    ACTION_FLIP,       // args: horizontal
+    ACTION_ROTATE,     // args: clockwise
+    ACTION_TOGGLE_INDEXED,
+    ACTION_NEW_TAB,    // first action of version 2 recordings
+    ACTION_SWITCH_TAB, // args: document
+    ACTION_DUPLICATE,
+    ACTION_COUNT,
+} action_type_t;
+
+typedef struct action {
+    action_type_t type;
+    int args[3];
+    float value;
+    char path[256];
+} action_t;
+
+typedef struct recorder {
+    FILE* f;
+    input_t last; // previous frame, only changed fields are written
+    ulong frames;
+    ulong actions;
+} recorder_t;
+
+typedef struct replay {
+    FILE* f;
+    uint version; // 1 predates document tabs
+    input_t input; // fields carry over between frames like in the recording
+    ulong frames;
+    action_t actions[REPLAY_MAX_ACTIONS];
+    int action_count;
+    bool corrupt;
+} replay_t;
+
+// Per-frame timings of a replay, in milliseconds
+typedef struct frame_timings {
+    double* update_ms;
+    double* draw_ms;
+    ulong count;
+    ulong capacity;
+} frame_timings_t;
+
+static inline bool input_down(const input_t* in, uint button) { return in->buttons_down & button; }
+static inline bool input_pressed(const input_t* in, uint button) { return in->buttons_pressed & button; }
+static inline bool input_released(const input_t* in, uint button) { return in->buttons_released & button; }
+static inline bool input_key_down(const input_t* in, uint key) { return in->keys_down & key; }
+static inline bool input_key_pressed(const input_t* in, uint key) { return in->keys_pressed & key; }
+
+// Keeps the mouse position but drops clicks, keys and scrolling, for frames
+// where a modal dialog owns the input and the canvas should see nothing
+static inline void input_idle(input_t* in) {
+    in->wheel = 0.0f;
+    in->buttons_down = in->buttons_pressed = in->buttons_released = 0;
+    in->keys_down = in->keys_pressed = 0;
+}
+
+void input_poll(input_t* in);
+
+bool recorder_open(recorder_t* rec, const char* path);
+void recorder_frame(recorder_t* rec, const input_t* in);
+void recorder_action(recorder_t* rec, const action_t* action);
+bool recorder_close(recorder_t* rec);
+
+bool replay_open(replay_t* rp, const char* path);
+bool replay_next_frame(replay_t* rp);
+void replay_close(replay_t* rp);
+
+double time_ms(void);
+void timings_add(frame_timings_t* t, double update_ms, double draw_ms);
+void timings_report(const frame_timings_t* t, bool has_draw);
+bool timings_write_csv(const frame_timings_t* t, const char* path);
+void timings_free(frame_timings_t* t);
+
+#endif // PRISM_REPLAY_H
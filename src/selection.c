@@ -0,0 +1,158 @@
+#include "selection.h"
+
+#include <string.h>
+
+ppm_image_t* copy_region(const ppm_image_t* img, rect_t r) {
+    r = clip_rect(r, img->width, img->height);
+    guardn(!rect_empty(r), "Cannot copy an empty region");
+
+    ppm_image_t* out = alloc_ppm_image(r.width, r.height, img->max_color);
+    if(!out) return NULL;
+
+    // One memcpy per row, rows of the source region are contiguous
+    const Color* src = img->pixels + (ulong)r.y * img->width + r.x;
+    Color* dst = out->pixels;
+    for(int y = 0; y < r.height; y++) {
+        memcpy(dst, src, (size_t)r.width * sizeof(Color));
+        src += img->width;
+        dst += r.width;
+    }
+
+    return out;
+}
+
+void paste_region(ppm_image_t* dst, const ppm_image_t* src, int x, int y) {
+    rect_t r = clip_rect((rect_t){ x, y, src->width, src->height }, dst->width, dst->height);
+    guardv_nl(!rect_empty(r));
+
+    // Offset into the source when the paste hangs off the top/left edge
+    int sx = r.x - x;
+    int sy = r.y - y;
+
+    const Color* s = src->pixels + (ulong)sy * src->width + sx;
+    Color* d = dst->pixels + (ulong)r.y * dst->width + r.x;
+    for(int row = 0; row < r.height; row++) {
+        memcpy(d, s, (size_t)r.width * sizeof(Color));
+        s += src->width;
+        d += dst->width;
+    }
+}
+
+void fill_region(ppm_image_t* img, rect_t r, Color color) {
+    r = clip_rect(r, img->width, img->height);
+    guardv_nl(!rect_empty(r));
+
+    Color* first = img->pixels + (ulong)r.y * img->width + r.x;
+    for(int x = 0; x < r.width; x++) {
+        first[x] = color;
+    }
+
+    // Replicate the first row instead of filling every pixel again
+    Color* row = first + img->width;
+    for(int y = 1; y < r.height; y++) {
+        memcpy(row, first, (size_t)r.width * sizeof(Color));
+        row += img->width;
+    }
+}
+
+bool crop_image(ppm_image_t* img, rect_t r) {
+    r = clip_rect(r, img->width, img->height);
+    if(rect_empty(r)) {
+        error("Cannot crop to an empty region");
+        return false;
+    }
+
+    // Compact rows toward the front in place, destination never overtakes source
+    const Color* src = img->pixels + (ulong)r.y * img->width + r.x;
+    Color* dst = img->pixels;
+    for(int y = 0; y < r.height; y++) {
+        memmove(dst, src, (size_t)r.width * sizeof(Color));
+        src += img->width;
+        dst += r.width;
+    }
+
+    Color* shrunk = realloc(img->pixels, (size_t)r.width * r.height * sizeof(Color));
+    if(shrunk) img->pixels = shrunk;
+
+    img->width = r.width;
+    img->height = r.height;
+    return true;
+}
+
+void flip_horizontal(ppm_image_t* img, rect_t r) {
+    r = clip_rect(r, img->width, img->height);
+    guardv_nl(!rect_empty(r));
+
+    for(int y = 0; y < r.height; y++) {
+        Color* row = img->pixels + (ulong)(r.y + y) * img->width + r.x;
+        int l = 0;
+        int rr = r.width - 1;
+        while(l < rr) {
+            Color t = row[l];
+            row[l] = row[rr];
+            row[rr] = t;
+            l++;
+            rr--;
+        }
+    }
+}
+
+void flip_vertical(ppm_image_t* img, rect_t r) {
+    r = clip_rect(r, img->width, img->height);
+    guardv_nl(!rect_empty(r));
+
+    size_t row_bytes = (size_t)r.width * sizeof(Color);
+    Color* tmp = make(Color, r.width);
+    guardv(tmp, "Unable to allocate row buffer for flip");
+
+    // Swap whole rows top/bottom through a single scratch row
+    int top = r.y;
+    int bottom = r.y + r.height - 1;
+    while(top < bottom) {
+        Color* a = img->pixels + (ulong)top * img->width + r.x;
+        Color* b = img->pixels + (ulong)bottom * img->width + r.x;
+        memcpy(tmp, a, row_bytes);
+        memcpy(a, b, row_bytes);
+        memcpy(b, tmp, row_bytes);
+        top++;
+        bottom--;
+    }
+
+    free(tmp);
+}
+
+ppm_image_t* rotate_image_90(const ppm_image_t* img, bool clockwise) {
+    uint w = img->width;
+    uint h = img->height;
+
+    ppm_image_t* out = alloc_ppm_image(h, w, img->max_color);
+    if(!out) return NULL;
+
+    // Walk the source in square tiles so both the reads and the strided writes
+    // stay inside a few cache lines per tile instead of thrashing on every pixel
+    for(uint ty = 0; ty < h; ty += ROTATE_TILE) {
+        uint ty_end = ty + ROTATE_TILE < h ? ty + ROTATE_TILE : h;
+        for(uint tx = 0; tx < w; tx += ROTATE_TILE) {
+            uint tx_end = tx + ROTATE_TILE < w ? tx + ROTATE_TILE : w;
+
+            for(uint y = ty; y < ty_end; y++) {
+                const Color* src = img->pixels + (ulong)y * w;
+                if(clockwise) {
+                    // (x, y) -> (h - 1 - y, x)
+                    Color* dst = out->pixels + (h - 1 - y);
+                    for(uint x = tx; x < tx_end; x++) {
+                        dst[(ulong)x * h] = src[x];
+                    }
+                } else {
+                    // (x, y) -> (y, w - 1 - x)
+                    Color* dst = out->pixels + y;
+                    for(uint x = tx; x < tx_end; x++) {
+                        dst[(ulong)(w - 1 - x) * h] = src[x];
+                    }
+                }
+            }
+        }
+    }
+
+    return out;
+}
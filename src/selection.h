@@ -0,0 +1,28 @@
+#ifndef PRISM_SELECTION_H
+#define PRISM_SELECTION_H
+
+#include "image.h"
+
+// Tile edge for the blocked rotation, 32 * 32 * 4 bytes = 4KB per tile
+#define ROTATE_TILE 32
+
+typedef struct selection {
+    bool active;
+    bool dragging;
+    bool moving;
+    int anchor_x;
+    int anchor_y;
+    rect_t rect;
+    ppm_image_t* floating; // lifted pixels while a selection is being moved
+} selection_t;
+
+ppm_image_t* copy_region(const ppm_image_t* img, rect_t r);
+void paste_region(ppm_image_t* dst, const ppm_image_t* src, int x, int y);
+void fill_region(ppm_image_t* img, rect_t r, Color color);
+
+bool crop_image(ppm_image_t* img, rect_t r);
+void flip_horizontal(ppm_image_t* img, rect_t r);
+void flip_vertical(ppm_image_t* img, rect_t r);
+ppm_image_t* rotate_image_90(const ppm_image_t* img, bool clockwise);
+
+#endif // PRISM_SELECTION_H
@@ -0,0 +1,336 @@
+// math.h must come before utils.h, which defines a log() macro
+#include <math.h>
+
+#include "stats.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct stats_job {
+    const ppm_image_t* img;
+    atomic_uint* color_counts;
+    uint y0;
+    uint y1;
+    ulong hist[3][256];
+    ulong unique_colors;
+    bool ok; // false when the worker couldn't allocate its scratch
+    const atomic_bool* cancel;
+} stats_job_t;
+
+// A computation running off the UI thread. It doesn't hold a reference to
+// its source, the owner cancels it before the pixels change or are freed
+typedef struct stats_task {
+    pthread_t thread;
+    atomic_bool done;
+    atomic_bool cancel;
+    const ppm_image_t* source;
+    stats_t result;
+} stats_task_t;
+
+static inline uint color_key(Color c) {
+    return (uint)c.r | ((uint)c.g << 8) | ((uint)c.b << 16);
+}
+
+static void* stats_worker(void* arg) {
+    stats_job_t* job = arg;
+    const ppm_image_t* img = job->img;
+
+    // Four interleaved sub-histograms per channel so consecutive pixels with the
+    // same value don't serialize on one counter's store-to-load dependency
+    uint (*sub)[3][256] = calloc(4, sizeof(*sub));
+    job->ok = sub != NULL;
+    guardn(sub, "Unable to allocate histogram scratch");
+
+    ulong unique = 0;
+    for(uint y = job->y0; y < job->y1; y++) {
+        if(job->cancel && atomic_load_explicit(job->cancel, memory_order_relaxed)) break;
+        const Color* row = img->pixels + (ulong)y * img->width;
+        uint x = 0;
+        for(; x + 4 <= img->width; x += 4) {
+            for(int k = 0; k < 4; k++) {
+                Color c = row[x + k];
+                sub[k][0][c.r]++;
+                sub[k][1][c.g]++;
+                sub[k][2][c.b]++;
+            }
+            for(int k = 0; k < 4; k++) {
+                uint prev = atomic_fetch_add_explicit(&job->color_counts[color_key(row[x + k])], 1, memory_order_relaxed);
+                unique += prev == 0;
+            }
+        }
+        for(; x < img->width; x++) {
+            Color c = row[x];
+            sub[0][0][c.r]++;
+            sub[0][1][c.g]++;
+            sub[0][2][c.b]++;
+            uint prev = atomic_fetch_add_explicit(&job->color_counts[color_key(c)], 1, memory_order_relaxed);
+            unique += prev == 0;
+        }
+
+        // Fold into 64-bit totals before a 32-bit sub-histogram bin could overflow
+        if(((y - job->y0) & 1023) == 1023 || y + 1 == job->y1) {
+            for(int k = 0; k < 4; k++) {
+                for(int ch = 0; ch < 3; ch++) {
+                    for(int v = 0; v < 256; v++) {
+                        job->hist[ch][v] += sub[k][ch][v];
+                    }
+                }
+            }
+            memset(sub, 0, 4 * sizeof(*sub));
+        }
+    }
+
+    job->unique_colors = unique;
+    free(sub);
+    return NULL;
+}
+
+// Indexed images count indices, then each palette entry adds its pixel count
+static void stats_compute_indexed(stats_t* stats, const ppm_image_t* img) {
+    ulong* counts = calloc(img->palette_size ? img->palette_size : 1, sizeof(ulong));
+    guardv(counts, "Unable to allocate palette counts");
+
+    ulong n = (ulong)img->width * img->height;
+    if(img->index8) {
+        for(ulong i = 0; i < n; i++) counts[img->index8[i]]++;
+    } else {
+        for(ulong i = 0; i < n; i++) counts[img->index16[i]]++;
+    }
+
+    for(uint p = 0; p < img->palette_size; p++) {
+        if(!counts[p]) continue;
+        Color c = img->palette[p];
+        stats->hist[0][c.r] += counts[p];
+        stats->hist[1][c.g] += counts[p];
+        stats->hist[2][c.b] += counts[p];
+
+        atomic_uint* count = &stats->color_counts[color_key(c)];
+        uint prev = atomic_load_explicit(count, memory_order_relaxed);
+        atomic_store_explicit(count, prev + (uint)counts[p], memory_order_relaxed);
+        if(prev == 0) stats->unique_colors++;
+    }
+
+    stats->pixel_count = n;
+    stats->valid = true;
+    free(counts);
+}
+
+static void stats_compute_until(stats_t* stats, const ppm_image_t* img, const atomic_bool* cancel) {
+    stats_free(stats);
+
+    // calloc hands back untouched zero pages, only the colors in use cost memory
+    stats->color_counts = calloc(STATS_COLORS, sizeof(atomic_uint));
+    guardv(stats->color_counts, "Unable to allocate color counts");
+
+    if(ppm_indexed(img)) {
+        stats_compute_indexed(stats, img);
+        return;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus < 1 ? 1 : (cpus > STATS_MAX_THREADS ? STATS_MAX_THREADS : (int)cpus);
+    if((uint)threads > img->height) threads = img->height ? img->height : 1;
+
+    stats_job_t* jobs = calloc(threads, sizeof(stats_job_t));
+    pthread_t* tids = make(pthread_t, threads);
+    if(!jobs || !tids) {
+        error("Unable to allocate statistics workers");
+        free(jobs);
+        free(tids);
+        return;
+    }
+
+    // Split by rows, each worker owns its histograms and only shares color counts
+    for(int i = 0; i < threads; i++) {
+        jobs[i].img = img;
+        jobs[i].cancel = cancel;
+        jobs[i].color_counts = stats->color_counts;
+        jobs[i].y0 = (uint)((ulong)img->height * i / threads);
+        jobs[i].y1 = (uint)((ulong)img->height * (i + 1) / threads);
+    }
+
+    int started = 0;
+    for(int i = 1; i < threads; i++) {
+        if(pthread_create(&tids[i], NULL, stats_worker, &jobs[i]) != 0) break;
+        started = i;
+    }
+
+    // Run the first band here, plus any band whose thread failed to start
+    stats_worker(&jobs[0]);
+    for(int i = started + 1; i < threads; i++) {
+        stats_worker(&jobs[i]);
+    }
+    for(int i = 1; i <= started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    // A band that wasn't counted would leave the totals short, keep them invalid
+    for(int i = 0; i < threads; i++) {
+        if(jobs[i].ok) continue;
+        error("Statistics worker failed, statistics unavailable");
+        free(jobs);
+        free(tids);
+        stats_free(stats);
+        return;
+    }
+
+    if(cancel && atomic_load_explicit(cancel, memory_order_relaxed)) {
+        free(jobs);
+        free(tids);
+        stats_free(stats);
+        return;
+    }
+
+    for(int i = 0; i < threads; i++) {
+        for(int ch = 0; ch < 3; ch++) {
+            for(int v = 0; v < 256; v++) {
+                stats->hist[ch][v] += jobs[i].hist[ch][v];
+            }
+        }
+        stats->unique_colors += jobs[i].unique_colors;
+    }
+
+    stats->pixel_count = (ulong)img->width * img->height;
+    stats->valid = true;
+
+    free(jobs);
+    free(tids);
+}
+
+void stats_compute(stats_t* stats, const ppm_image_t* img) {
+    stats_compute_until(stats, img, NULL);
+}
+
+static void* stats_task_run(void* arg) {
+    stats_task_t* task = arg;
+    stats_compute_until(&task->result, task->source, &task->cancel);
+    atomic_store_explicit(&task->done, true, memory_order_release);
+    return NULL;
+}
+
+// Starts computing in the background, stats_poll adopts the result. Falls
+// back to computing here when no thread can be started
+void stats_compute_async(stats_t* stats, const ppm_image_t* img) {
+    stats_free(stats);
+
+    stats_task_t* task = calloc(1, sizeof(stats_task_t));
+    if(task) {
+        task->source = img;
+        if(pthread_create(&task->thread, NULL, stats_task_run, task) == 0) {
+            stats->task = task;
+            return;
+        }
+        free(task);
+    }
+    stats_compute(stats, img);
+}
+
+static stats_t stats_task_join(stats_task_t* task) {
+    pthread_join(task->thread, NULL);
+    stats_t result = task->result;
+    free(task);
+    return result;
+}
+
+// Before writing to the source of a pending computation: stops it and marks
+// the stats stale, so the next stats_poll starts over on the edited pixels
+void stats_cancel(stats_t* stats) {
+    if(!stats->task) return;
+    stats_free(stats);
+    stats->stale = true;
+}
+
+// Once per frame: adopts a finished computation, or restarts a cancelled one
+void stats_poll(stats_t* stats, const ppm_image_t* img) {
+    if(stats->stale) {
+        if(img) stats_compute_async(stats, img);
+        return;
+    }
+
+    stats_task_t* task = stats->task;
+    if(!task || !atomic_load_explicit(&task->done, memory_order_acquire)) return;
+
+    stats->task = NULL;
+    *stats = stats_task_join(task);
+}
+
+void stats_free(stats_t* stats) {
+    if(stats->task) {
+        atomic_store_explicit(&stats->task->cancel, true, memory_order_relaxed);
+        stats_t result = stats_task_join(stats->task);
+        stats_free(&result);
+    }
+    free(stats->color_counts);
+    *stats = (stats_t){ 0 };
+}
+
+static void stats_apply_region(stats_t* stats, const ppm_image_t* img, rect_t r, int sign) {
+    if(!stats->valid) return;
+    r = clip_rect(r, img->width, img->height);
+    if(rect_empty(r)) return;
+
+    for(int y = r.y; y < r.y + r.height; y++) {
+        ulong row = (ulong)y * img->width + r.x;
+        for(int x = 0; x < r.width; x++) {
+            Color c = ppm_pixel(img, row + x);
+            stats->hist[0][c.r] += sign;
+            stats->hist[1][c.g] += sign;
+            stats->hist[2][c.b] += sign;
+
+            atomic_uint* count = &stats->color_counts[color_key(c)];
+            uint prev = atomic_load_explicit(count, memory_order_relaxed);
+            atomic_store_explicit(count, prev + sign, memory_order_relaxed);
+            if(sign > 0 && prev == 0) stats->unique_colors++;
+            if(sign < 0 && prev == 1) stats->unique_colors--;
+        }
+    }
+}
+
+void stats_remove_region(stats_t* stats, const ppm_image_t* img, rect_t r) {
+    stats_apply_region(stats, img, r, -1);
+}
+
+void stats_add_region(stats_t* stats, const ppm_image_t* img, rect_t r) {
+    stats_apply_region(stats, img, r, 1);
+}
+
+void stats_replace_color(stats_t* stats, Color old_color, Color new_color, ulong count) {
+    if(!stats->valid || count == 0 || colors_equal(old_color, new_color)) return;
+
+    stats->hist[0][old_color.r] -= count;
+    stats->hist[1][old_color.g] -= count;
+    stats->hist[2][old_color.b] -= count;
+    stats->hist[0][new_color.r] += count;
+    stats->hist[1][new_color.g] += count;
+    stats->hist[2][new_color.b] += count;
+
+    atomic_uint* old_count = &stats->color_counts[color_key(old_color)];
+    atomic_uint* new_count = &stats->color_counts[color_key(new_color)];
+    uint old_prev = atomic_load_explicit(old_count, memory_order_relaxed);
+    uint new_prev = atomic_load_explicit(new_count, memory_order_relaxed);
+    atomic_store_explicit(old_count, old_prev - (uint)count, memory_order_relaxed);
+    atomic_store_explicit(new_count, new_prev + (uint)count, memory_order_relaxed);
+
+    if(old_prev == count) stats->unique_colors--;
+    if(new_prev == 0) stats->unique_colors++;
+}
+
+void stats_channel(const stats_t* stats, int channel, double* mean, double* stddev) {
+    *mean = 0.0;
+    *stddev = 0.0;
+    if(!stats->valid || stats->pixel_count == 0) return;
+
+    // Moments straight from the histogram, 256 bins instead of every pixel
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    for(int v = 0; v < 256; v++) {
+        double n = (double)stats->hist[channel][v];
+        sum += n * v;
+        sum_sq += n * v * v;
+    }
+
+    *mean = sum / stats->pixel_count;
+    double variance = sum_sq / stats->pixel_count - *mean * *mean;
+    *stddev = variance > 0.0 ? sqrt(variance) : 0.0;
+}
@@ -0,0 +1,33 @@
+#ifndef PRISM_STATS_H
+#define PRISM_STATS_H
+
+#include "image.h"
+
+#define STATS_MAX_THREADS 16
+#define STATS_COLORS (1 << 24)
+
+// RGB histogram and color statistics, computed once per image and then kept
+// current from the regions edits report instead of rescanning every frame
+typedef struct stats {
+    bool valid;
+    ulong pixel_count;
+    ulong hist[3][256];
+    ulong unique_colors;
+    atomic_uint* color_counts; // pixels per 24-bit color, pages are only touched when used
+    struct stats_task* task;   // background computation, the stats stay invalid until it's adopted
+    bool stale;                // the computation was cancelled by an edit and has to rerun
+} stats_t;
+
+void stats_compute(stats_t* stats, const ppm_image_t* img);
+void stats_compute_async(stats_t* stats, const ppm_image_t* img);
+void stats_cancel(stats_t* stats);
+void stats_poll(stats_t* stats, const ppm_image_t* img);
+void stats_free(stats_t* stats);
+
+void stats_remove_region(stats_t* stats, const ppm_image_t* img, rect_t r);
+void stats_add_region(stats_t* stats, const ppm_image_t* img, rect_t r);
+void stats_replace_color(stats_t* stats, Color old_color, Color new_color, ulong count);
+
+void stats_channel(const stats_t* stats, int channel, double* mean, double* stddev);
+
+#endif // PRISM_STATS_H
@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+#include "stream.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#ifdef PRISM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Compressed bytes are read/written in chunks of this size
+#define STREAM_IO_CHUNK (256 * 1024)
+
+typedef struct stream {
+    FILE* file; // the compressed file on disk
+    stream_codec_t codec;
+    block_ring_t ring;
+    pthread_t thread;
+
+    // Block the caller's side currently owns, being read from or filled
+    char* current;
+    size_t current_len;
+    size_t current_pos;
+} stream_t;
+
+static bool ring_init(block_ring_t* ring) {
+    *ring = (block_ring_t){ 0 };
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+
+    for(int i = 0; i < STREAM_RING_BLOCKS; i++) {
+        ring->data[i] = make(char, STREAM_BLOCK_SIZE);
+        if(!ring->data[i]) return false;
+    }
+    return true;
+}
+
+static void ring_destroy(block_ring_t* ring) {
+    for(int i = 0; i < STREAM_RING_BLOCKS; i++) {
+        free(ring->data[i]);
+    }
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->changed);
+}
+
+// Producer side: wait for a free block, NULL once the consumer cancelled
+static char* ring_acquire_empty(block_ring_t* ring) {
+    pthread_mutex_lock(&ring->lock);
+    while(ring->count == STREAM_RING_BLOCKS && !ring->cancelled && !ring->failed) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    char* block = ring->cancelled || ring->failed ? NULL : ring->data[(ring->head + ring->count) % STREAM_RING_BLOCKS];
+    pthread_mutex_unlock(&ring->lock);
+    return block;
+}
+
+static void ring_push(block_ring_t* ring, size_t len) {
+    pthread_mutex_lock(&ring->lock);
+    ring->len[(ring->head + ring->count) % STREAM_RING_BLOCKS] = len;
+    ring->count++;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Consumer side: wait for a filled block, NULL once the producer is done and
+// everything it pushed has been consumed
+static char* ring_acquire_full(block_ring_t* ring, size_t* len) {
+    pthread_mutex_lock(&ring->lock);
+    while(ring->count == 0 && !ring->closed && !ring->failed) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    char* block = NULL;
+    if(ring->count > 0) {
+        block = ring->data[ring->head];
+        *len = ring->len[ring->head];
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return block;
+}
+
+static void ring_pop(block_ring_t* ring) {
+    pthread_mutex_lock(&ring->lock);
+    ring->head = (ring->head + 1) % STREAM_RING_BLOCKS;
+    ring->count--;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void ring_finish(block_ring_t* ring, bool failed) {
+    pthread_mutex_lock(&ring->lock);
+    ring->closed = true;
+    if(failed) ring->failed = true;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void ring_cancel(block_ring_t* ring) {
+    pthread_mutex_lock(&ring->lock);
+    ring->cancelled = true;
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void* inflate_gzip(stream_t* s) {
+    unsigned char* in = make(unsigned char, STREAM_IO_CHUNK);
+    z_stream z = { 0 };
+    bool ok = in && inflateInit2(&z, 15 + 32) == Z_OK; // 15 + 32 accepts gzip and zlib headers
+
+    char* out = NULL;
+    bool finished = false; // the last member ended cleanly
+    bool flushed = true;   // inflate has no output pending, more input is needed
+    while(ok) {
+        if(z.avail_in == 0 && flushed) {
+            z.avail_in = fread(in, 1, STREAM_IO_CHUNK, s->file);
+            z.next_in = in;
+            if(z.avail_in == 0) {
+                ok = finished && !ferror(s->file);
+                if(!ok) error("Truncated or unreadable gzip stream");
+                break;
+            }
+        }
+
+        // Concatenated members, e.g. from pigz or cat a.gz b.gz
+        if(finished && z.avail_in > 0) {
+            inflateReset(&z);
+            finished = false;
+        }
+
+        if(!out) {
+            out = ring_acquire_empty(&s->ring);
+            if(!out) break;
+            z.next_out = (unsigned char*)out;
+            z.avail_out = STREAM_BLOCK_SIZE;
+        }
+
+        int ret = inflate(&z, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END) {
+            finished = true;
+        } else if(ret != Z_OK && ret != Z_BUF_ERROR) {
+            error("gzip decompression failed: %s", z.msg ? z.msg : "unknown error");
+            ok = false;
+            break;
+        }
+        flushed = finished || z.avail_out > 0;
+
+        if(z.avail_out == 0) {
+            ring_push(&s->ring, STREAM_BLOCK_SIZE);
+            out = NULL;
+        }
+    }
+
+    // Hand over what was decoded even on failure, the parser reports where it stopped
+    if(out && z.avail_out < STREAM_BLOCK_SIZE) {
+        ring_push(&s->ring, STREAM_BLOCK_SIZE - z.avail_out);
+    }
+
+    inflateEnd(&z);
+    free(in);
+    ring_finish(&s->ring, !ok);
+    return NULL;
+}
+
+static void* deflate_gzip(stream_t* s) {
+    unsigned char* out = make(unsigned char, STREAM_IO_CHUNK);
+    z_stream z = { 0 };
+    bool ok = out && deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK; // 15 + 16 writes a gzip header
+
+    for(;;) {
+        size_t len = 0;
+        char* block = ok ? ring_acquire_full(&s->ring, &len) : NULL;
+        int flush = block ? Z_NO_FLUSH : Z_FINISH;
+        if(!ok) break;
+
+        z.next_in = (unsigned char*)block;
+        z.avail_in = block ? len : 0;
+        int ret;
+        do {
+            z.next_out = out;
+            z.avail_out = STREAM_IO_CHUNK;
+            ret = deflate(&z, flush);
+            size_t produced = STREAM_IO_CHUNK - z.avail_out;
+            if(produced && fwrite(out, 1, produced, s->file) != produced) {
+                error("Failed to write compressed data");
+                ok = false;
+                break;
+            }
+        } while(z.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+        if(block) ring_pop(&s->ring);
+        if(!block) break;
+    }
+
+    deflateEnd(&z);
+    free(out);
+
+    // Wake a writer waiting for space if we bailed out early
+    if(!ok) ring_finish(&s->ring, true);
+    return NULL;
+}
+
+#ifdef PRISM_HAVE_ZSTD
+static void* inflate_zstd(stream_t* s) {
+    size_t in_size = ZSTD_DStreamInSize();
+    unsigned char* in = make(unsigned char, in_size);
+    ZSTD_DStream* z = ZSTD_createDStream();
+    bool ok = in && z;
+
+    ZSTD_inBuffer input = { in, 0, 0 };
+    ZSTD_outBuffer output = { NULL, STREAM_BLOCK_SIZE, 0 };
+    size_t ret = 0;
+    bool flushed = true; // the decoder has no output pending, more input is needed
+    while(ok) {
+        if(input.pos == input.size && flushed) {
+            input.size = fread(in, 1, in_size, s->file);
+            input.pos = 0;
+            if(input.size == 0) {
+                // ret is 0 only when the last frame was fully decoded
+                ok = ret == 0 && !ferror(s->file);
+                if(!ok) error("Truncated or unreadable zstd stream");
+                break;
+            }
+        }
+
+        if(!output.dst) {
+            output.dst = ring_acquire_empty(&s->ring);
+            if(!output.dst) break;
+            output.pos = 0;
+        }
+
+        ret = ZSTD_decompressStream(z, &output, &input);
+        if(ZSTD_isError(ret)) {
+            error("zstd decompression failed: %s", ZSTD_getErrorName(ret));
+            ok = false;
+            break;
+        }
+        flushed = output.pos < output.size;
+
+        if(output.pos == output.size) {
+            ring_push(&s->ring, output.pos);
+            output.dst = NULL;
+        }
+    }
+
+    if(output.dst && output.pos > 0) {
+        ring_push(&s->ring, output.pos);
+    }
+
+    ZSTD_freeDStream(z);
+    free(in);
+    ring_finish(&s->ring, !ok);
+    return NULL;
+}
+
+static void* deflate_zstd(stream_t* s) {
+    size_t out_size = ZSTD_CStreamOutSize();
+    unsigned char* out = make(unsigned char, out_size);
+    ZSTD_CCtx* z = ZSTD_createCCtx();
+    bool ok = out && z;
+
+    for(;;) {
+        size_t len = 0;
+        char* block = ok ? ring_acquire_full(&s->ring, &len) : NULL;
+        ZSTD_EndDirective mode = block ? ZSTD_e_continue : ZSTD_e_end;
+        if(!ok) break;
+
+        ZSTD_inBuffer input = { block, block ? len : 0, 0 };
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = { out, out_size, 0 };
+            remaining = ZSTD_compressStream2(z, &output, &input, mode);
+            if(ZSTD_isError(remaining)) {
+                error("zstd compression failed: %s", ZSTD_getErrorName(remaining));
+                ok = false;
+                break;
+            }
+            if(output.pos && fwrite(out, 1, output.pos, s->file) != output.pos) {
+                error("Failed to write compressed data");
+                ok = false;
+                break;
+            }
+        } while(mode == ZSTD_e_end ? remaining != 0 : input.pos < input.size);
+
+        if(block) ring_pop(&s->ring);
+        if(!block) break;
+    }
+
+    ZSTD_freeCCtx(z);
+    free(out);
+    if(!ok) ring_finish(&s->ring, true);
+    return NULL;
+}
+#endif
+
+static void* stream_reader_thread(void* arg) {
+    stream_t* s = arg;
+#ifdef PRISM_HAVE_ZSTD
+    if(s->codec == CODEC_ZSTD) return inflate_zstd(s);
+#endif
+    return inflate_gzip(s);
+}
+
+static void* stream_writer_thread(void* arg) {
+    stream_t* s = arg;
+#ifdef PRISM_HAVE_ZSTD
+    if(s->codec == CODEC_ZSTD) return deflate_zstd(s);
+#endif
+    return deflate_gzip(s);
+}
+
+static ssize_t stream_read(void* cookie, char* buf, size_t size) {
+    stream_t* s = cookie;
+    size_t copied = 0;
+
+    while(copied < size) {
+        if(!s->current) {
+            s->current = ring_acquire_full(&s->ring, &s->current_len);
+            s->current_pos = 0;
+            if(!s->current) break;
+        }
+
+        size_t n = s->current_len - s->current_pos;
+        if(n > size - copied) n = size - copied;
+        memcpy(buf + copied, s->current + s->current_pos, n);
+        copied += n;
+        s->current_pos += n;
+
+        if(s->current_pos == s->current_len) {
+            ring_pop(&s->ring);
+            s->current = NULL;
+        }
+    }
+
+    if(copied == 0 && s->ring.failed) return -1;
+    return copied;
+}
+
+static ssize_t stream_write(void* cookie, const char* buf, size_t size) {
+    stream_t* s = cookie;
+    size_t copied = 0;
+
+    while(copied < size) {
+        if(!s->current) {
+            s->current = ring_acquire_empty(&s->ring);
+            s->current_len = 0;
+            if(!s->current) return -1;
+        }
+
+        size_t n = STREAM_BLOCK_SIZE - s->current_len;
+        if(n > size - copied) n = size - copied;
+        memcpy(s->current + s->current_len, buf + copied, n);
+        copied += n;
+        s->current_len += n;
+
+        if(s->current_len == STREAM_BLOCK_SIZE) {
+            ring_push(&s->ring, s->current_len);
+            s->current = NULL;
+        }
+    }
+
+    return copied;
+}
+
+static int stream_close_read(void* cookie) {
+    stream_t* s = cookie;
+    ring_cancel(&s->ring);
+    pthread_join(s->thread, NULL);
+
+    int ret = fclose(s->file);
+    ring_destroy(&s->ring);
+    free(s);
+    return ret;
+}
+
+static int stream_close_write(void* cookie) {
+    stream_t* s = cookie;
+    if(s->current && s->current_len > 0) {
+        ring_push(&s->ring, s->current_len);
+    }
+    ring_finish(&s->ring, false);
+    pthread_join(s->thread, NULL);
+
+    bool failed = s->ring.failed;
+    if(fclose(s->file) != 0) failed = true;
+    ring_destroy(&s->ring);
+    free(s);
+    return failed ? -1 : 0;
+}
+
+static FILE* stream_start(FILE* file, stream_codec_t codec, bool writing) {
+    stream_t* s = calloc(1, sizeof(stream_t));
+    if(!s || !ring_init(&s->ring)) {
+        error("Unable to allocate stream buffers");
+        if(s) ring_destroy(&s->ring);
+        free(s);
+        fclose(file);
+        return NULL;
+    }
+    s->file = file;
+    s->codec = codec;
+
+    if(pthread_create(&s->thread, NULL, writing ? stream_writer_thread : stream_reader_thread, s) != 0) {
+        error("Unable to start stream thread");
+        ring_destroy(&s->ring);
+        free(s);
+        fclose(file);
+        return NULL;
+    }
+
+    cookie_io_functions_t io = { 0 };
+    if(writing) {
+        io.write = stream_write;
+        io.close = stream_close_write;
+    } else {
+        io.read = stream_read;
+        io.close = stream_close_read;
+    }
+
+    FILE* f = fopencookie(s, writing ? "w" : "r", io);
+    if(!f) {
+        error("Unable to open stream");
+        io.close(s);
+        return NULL;
+    }
+    return f;
+}
+
+stream_codec_t stream_codec_for_path(const char* path) {
+    size_t len = strlen(path);
+    if(len >= 3 && smatch(path + len - 3, ".gz")) return CODEC_GZIP;
+    if(len >= 4 && smatch(path + len - 4, ".zst")) return CODEC_ZSTD;
+    return CODEC_NONE;
+}
+
+FILE* stream_open_read(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if(!file) return NULL;
+
+    // Detect compression from the magic bytes rather than trusting the name
+    unsigned char magic[4] = { 0 };
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    rewind(file);
+
+    stream_codec_t codec = CODEC_NONE;
+    if(got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) codec = CODEC_GZIP;
+    if(got == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) codec = CODEC_ZSTD;
+
+    if(codec == CODEC_NONE) return file;
+
+#ifndef PRISM_HAVE_ZSTD
+    if(codec == CODEC_ZSTD) {
+        error("%s is zstd compressed, but prism was built without zstd", path);
+        fclose(file);
+        return NULL;
+    }
+#endif
+
+    return stream_start(file, codec, false);
+}
+
+FILE* stream_open_write(const char* path) {
+    stream_codec_t codec = stream_codec_for_path(path);
+    FILE* file = fopen(path, codec == CODEC_NONE ? "w" : "wb");
+    if(!file || codec == CODEC_NONE) return file;
+
+#ifndef PRISM_HAVE_ZSTD
+    if(codec == CODEC_ZSTD) {
+        error("Cannot write %s, prism was built without zstd", path);
+        fclose(file);
+        return NULL;
+    }
+#endif
+
+    return stream_start(file, codec, true);
+}
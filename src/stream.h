@@ -0,0 +1,42 @@
+#ifndef PRISM_STREAM_H
+#define PRISM_STREAM_H
+
+#include <pthread.h>
+
+#include "utils.h"
+
+// Decompressed bytes are handed between threads in blocks of this size,
+// so at most STREAM_RING_BLOCKS blocks are in flight per stream
+#define STREAM_BLOCK_SIZE (1 << 20)
+#define STREAM_RING_BLOCKS 4
+
+typedef enum stream_codec {
+    CODEC_NONE,
+    CODEC_GZIP,
+    CODEC_ZSTD,
+} stream_codec_t;
+
+// Bounded queue of blocks between a producer and a consumer thread
+typedef struct block_ring {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char* data[STREAM_RING_BLOCKS];
+    size_t len[STREAM_RING_BLOCKS];
+    int head;       // oldest filled block
+    int count;      // filled blocks waiting for the consumer
+    bool closed;    // producer is done, no more blocks will be pushed
+    bool failed;    // either side hit an error
+    bool cancelled; // consumer stopped early, producer should exit
+} block_ring_t;
+
+// Open a file for reading, transparently decompressing gzip/zstd on a
+// background thread while the caller parses. Plain files are opened as is
+FILE* stream_open_read(const char* path);
+
+// Open a file for writing, compressing on a background thread when the
+// path ends in .gz or .zst. fclose reports compression/write failures
+FILE* stream_open_write(const char* path);
+
+stream_codec_t stream_codec_for_path(const char* path);
+
+#endif // PRISM_STREAM_H
@@ -0,0 +1,365 @@
+#include "thumbs.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char THUMB_MAGIC[4] = { 'P', 'R', 'T', 'H' };
+static const uint THUMB_VERSION = 1;
+
+// On-disk cache entry, followed by the source path and width * height RGB triples
+typedef struct thumb_header {
+    char magic[4];
+    uint version;
+    long mtime;
+    long size;
+    uint width;
+    uint height;
+    uint path_len;
+} thumb_header_t;
+
+static inline bool is_space(int c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+}
+
+static bool read_value(FILE* f, uint* v) {
+    int c = getc_unlocked(f);
+    while(is_space(c)) c = getc_unlocked(f);
+    if(c < '0' || c > '9') return false;
+
+    uint n = 0;
+    while(c >= '0' && c <= '9') {
+        n = n * 10 + (c - '0');
+        c = getc_unlocked(f);
+    }
+    *v = n;
+    return true;
+}
+
+// Step over P3 values without converting them, the text has to be scanned either way
+static bool skip_values(FILE* f, ulong n) {
+    if(n == 0) return true;
+
+    int c = getc_unlocked(f);
+    while(n > 0) {
+        while(is_space(c)) c = getc_unlocked(f);
+        if(c == EOF) return false;
+        while(c != EOF && !is_space(c)) c = getc_unlocked(f);
+        n--;
+    }
+    return true;
+}
+
+// Nearest-neighbour sample on a stride of whole pixels, stopping after the
+// last sampled row instead of reading the rest of the file
+ppm_image_t* thumb_generate(const char* path) {
+    ppm_reader_t r;
+    if(!ppm_reader_open(&r, path)) return NULL;
+    if(r.width == 0 || r.height == 0) {
+        ppm_reader_close(&r);
+        return NULL;
+    }
+
+    uint stride_x = (r.width + THUMB_SIZE - 1) / THUMB_SIZE;
+    uint stride_y = (r.height + THUMB_SIZE - 1) / THUMB_SIZE;
+    uint stride = stride_x > stride_y ? stride_x : stride_y;
+    uint tw = (r.width + stride - 1) / stride;
+    uint th = (r.height + stride - 1) / stride;
+
+    ppm_image_t* thumb = alloc_ppm_image(tw, th, 255);
+    if(!thumb) {
+        ppm_reader_close(&r);
+        return NULL;
+    }
+
+    float scale = 255.0f / r.max_color;
+    bool ok = true;
+    flockfile(r.f);
+    for(uint ty = 0; ty < th && ok; ty++) {
+        if(ty > 0) ok = skip_values(r.f, (ulong)(stride - 1) * r.width * 3);
+
+        Color* row = thumb->pixels + (ulong)ty * tw;
+        for(uint tx = 0; tx < tw && ok; tx++) {
+            uint cr, cg, cb;
+            ok = read_value(r.f, &cr) && read_value(r.f, &cg) && read_value(r.f, &cb);
+            if(!ok) break;
+            row[tx] = (Color){ (unsigned char)(cr * scale), (unsigned char)(cg * scale), (unsigned char)(cb * scale), 255 };
+
+            uint rest = (tx + 1 < tw ? stride : r.width - tx * stride) - 1;
+            ok = skip_values(r.f, (ulong)rest * 3);
+        }
+    }
+    funlockfile(r.f);
+    ppm_reader_close(&r);
+
+    if(!ok) {
+        error("Failed to read pixel data for thumbnail: %s", path);
+        free_ppm_image(thumb);
+        return NULL;
+    }
+    return thumb;
+}
+
+// Keyed on the path alone so an edited file reuses its entry instead of leaving
+// the old one behind, the header's mtime and size tell whether it's current
+static ulong cache_key(const char* path) {
+    ulong h = 0xcbf29ce484222325UL;
+    for(const char* p = path; *p; p++) {
+        h = (h ^ (unsigned char)*p) * 0x100000001b3UL;
+    }
+    return h;
+}
+
+static bool cache_file(const thumb_pool_t* pool, const thumb_job_t* job, char* out, size_t out_size) {
+    int n = snprintf(out, out_size, "%s/%016lx.thumb", pool->cache_dir, cache_key(job->path));
+    return n > 0 && (size_t)n < out_size;
+}
+
+static ppm_image_t* cache_load(const char* file, const thumb_job_t* job) {
+    FILE* f = fopen(file, "rb");
+    if(!f) return NULL;
+
+    // A stale or colliding entry just misses, the caller regenerates and overwrites it
+    thumb_header_t h;
+    char path[PATH_MAX];
+    ppm_image_t* thumb = NULL;
+    if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, THUMB_MAGIC, sizeof(THUMB_MAGIC)) != 0 || h.version != THUMB_VERSION) goto done;
+    if(h.mtime != job->mtime || h.size != job->size || h.path_len >= sizeof(path)) goto done;
+    if(h.width == 0 || h.height == 0 || h.width > THUMB_SIZE || h.height > THUMB_SIZE) goto done;
+    if(fread(path, 1, h.path_len, f) != h.path_len) goto done;
+    path[h.path_len] = '\0';
+    if(!smatch(path, job->path)) goto done;
+
+    unsigned char rgb[THUMB_SIZE * 3];
+    thumb = alloc_ppm_image(h.width, h.height, 255);
+    if(!thumb) goto done;
+    for(uint y = 0; y < h.height; y++) {
+        if(fread(rgb, 3, h.width, f) != h.width) {
+            free_ppm_image(thumb);
+            thumb = NULL;
+            goto done;
+        }
+        Color* row = thumb->pixels + (ulong)y * h.width;
+        for(uint x = 0; x < h.width; x++) {
+            row[x] = (Color){ rgb[x * 3], rgb[x * 3 + 1], rgb[x * 3 + 2], 255 };
+        }
+    }
+
+done:
+    fclose(f);
+    return thumb;
+}
+
+static void cache_store(const char* file, const thumb_job_t* job, const ppm_image_t* thumb) {
+    // Written aside and renamed, so other workers and processes never see half a file
+    char tmp[PATH_MAX + 64];
+    int n = snprintf(tmp, sizeof(tmp), "%s.%lx.tmp", file, (ulong)pthread_self());
+    if(n < 0 || (size_t)n >= sizeof(tmp)) return;
+    FILE* f = fopen(tmp, "wb");
+    if(!f) return;
+
+    thumb_header_t h = { 0 };
+    memcpy(h.magic, THUMB_MAGIC, sizeof(THUMB_MAGIC));
+    h.version = THUMB_VERSION;
+    h.mtime = job->mtime;
+    h.size = job->size;
+    h.width = thumb->width;
+    h.height = thumb->height;
+    h.path_len = strlen(job->path);
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(job->path, 1, h.path_len, f);
+
+    unsigned char rgb[THUMB_SIZE * 3];
+    for(uint y = 0; y < thumb->height; y++) {
+        const Color* row = thumb->pixels + (ulong)y * thumb->width;
+        for(uint x = 0; x < thumb->width; x++) {
+            rgb[x * 3] = row[x].r;
+            rgb[x * 3 + 1] = row[x].g;
+            rgb[x * 3 + 2] = row[x].b;
+        }
+        fwrite(rgb, 3, thumb->width, f);
+    }
+
+    bool ok = !ferror(f);
+    if(fclose(f) != 0) ok = false;
+    if(!ok || rename(tmp, file) != 0) unlink(tmp);
+}
+
+static void thumb_process(thumb_pool_t* pool, thumb_job_t* job) {
+    char file[PATH_MAX + 32];
+    bool use_cache = pool->cache_dir[0] && cache_file(pool, job, file, sizeof(file));
+    if(use_cache) {
+        job->thumb = cache_load(file, job);
+        if(job->thumb) {
+            job->ok = job->cached = true;
+            return;
+        }
+    }
+
+    job->thumb = thumb_generate(job->path);
+    job->ok = job->thumb != NULL;
+    if(job->ok && use_cache) cache_store(file, job, job->thumb);
+}
+
+static void* thumb_worker(void* arg) {
+    thumb_pool_t* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for(;;) {
+        while(!pool->stopping && !pool->queue_head) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if(pool->stopping) break;
+
+        thumb_job_t* job = pool->queue_head;
+        pool->queue_head = job->next;
+        if(!pool->queue_head) pool->queue_tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        thumb_process(pool, job);
+
+        pthread_mutex_lock(&pool->lock);
+        if(job->generation == pool->generation) {
+            job->next = pool->done;
+            pool->done = job;
+        } else {
+            thumb_job_free(job);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// mkdir -p, leaving path unchanged
+static bool make_dirs(char* path) {
+    for(char* p = path + 1; ; p++) {
+        if(*p != '/' && *p != '\0') continue;
+        char saved = *p;
+        *p = '\0';
+        bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *p = saved;
+        if(!ok) return false;
+        if(saved == '\0') return true;
+    }
+}
+
+static void thumb_cache_dir(char* out, size_t out_size) {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if(xdg && xdg[0]) {
+        snprintf(out, out_size, "%s/prism/thumbs", xdg);
+    } else if(home && home[0]) {
+        snprintf(out, out_size, "%s/.cache/prism/thumbs", home);
+    } else {
+        out[0] = '\0';
+        return;
+    }
+
+    if(!make_dirs(out)) {
+        error("Unable to create thumbnail cache %s, thumbnails won't persist", out);
+        out[0] = '\0';
+    }
+}
+
+bool thumb_pool_start(thumb_pool_t* pool) {
+    *pool = (thumb_pool_t){ 0 };
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    thumb_cache_dir(pool->cache_dir, sizeof(pool->cache_dir));
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus < 1 ? 1 : (cpus > THUMB_MAX_THREADS ? THUMB_MAX_THREADS : (int)cpus);
+    for(int i = 0; i < threads; i++) {
+        if(pthread_create(&pool->threads[pool->thread_count], NULL, thumb_worker, pool) != 0) break;
+        pool->thread_count++;
+    }
+
+    if(pool->thread_count == 0) {
+        error("Unable to start thumbnail workers");
+        thumb_pool_stop(pool);
+        return false;
+    }
+    return true;
+}
+
+static void free_jobs(thumb_job_t* job) {
+    while(job) {
+        thumb_job_t* next = job->next;
+        thumb_job_free(job);
+        job = next;
+    }
+}
+
+void thumb_pool_stop(thumb_pool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    free_jobs(pool->queue_head);
+    free_jobs(pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    *pool = (thumb_pool_t){ 0 };
+}
+
+void thumb_pool_request(thumb_pool_t* pool, const char* path, long mtime, long size, int index) {
+    if(pool->thread_count == 0) return;
+
+    thumb_job_t* job = calloc(1, sizeof(thumb_job_t));
+    guardv(job, "Unable to allocate thumbnail job");
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->mtime = mtime;
+    job->size = size;
+    job->index = index;
+
+    pthread_mutex_lock(&pool->lock);
+    job->generation = pool->generation;
+    if(pool->queue_tail) {
+        pool->queue_tail->next = job;
+    } else {
+        pool->queue_head = job;
+    }
+    pool->queue_tail = job;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Forget queued and finished jobs, e.g. when the browser leaves a directory.
+// Jobs already running finish but their results are dropped
+void thumb_pool_cancel(thumb_pool_t* pool) {
+    if(pool->thread_count == 0) return;
+
+    pthread_mutex_lock(&pool->lock);
+    thumb_job_t* queued = pool->queue_head;
+    thumb_job_t* done = pool->done;
+    pool->queue_head = pool->queue_tail = NULL;
+    pool->done = NULL;
+    pool->generation++;
+    pthread_mutex_unlock(&pool->lock);
+
+    free_jobs(queued);
+    free_jobs(done);
+}
+
+// Finished jobs as a list linked through next, owned by the caller
+thumb_job_t* thumb_pool_collect(thumb_pool_t* pool) {
+    if(pool->thread_count == 0) return NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    thumb_job_t* done = pool->done;
+    pool->done = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return done;
+}
+
+void thumb_job_free(thumb_job_t* job) {
+    if(!job) return;
+    free_ppm_image(job->thumb);
+    free(job);
+}
@@ -0,0 +1,50 @@
+#ifndef PRISM_THUMBS_H
+#define PRISM_THUMBS_H
+
+#include <limits.h>
+#include <pthread.h>
+
+#include "image.h"
+
+// Longest side of a thumbnail in pixels
+#define THUMB_SIZE 96
+#define THUMB_MAX_THREADS 4
+
+typedef struct thumb_job {
+    struct thumb_job* next;
+    char path[PATH_MAX];
+    long mtime;
+    long size;
+    int index;       // caller's entry index, handed back with the result
+    uint generation;
+    bool ok;
+    bool cached;     // served from the on-disk cache
+    ppm_image_t* thumb;
+} thumb_job_t;
+
+// Worker threads turning image paths into thumbnails, through an on-disk cache
+// keyed by path, mtime and size so revisited directories never reparse images
+typedef struct thumb_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t threads[THUMB_MAX_THREADS];
+    int thread_count;
+    thumb_job_t* queue_head; // waiting for a worker, oldest first
+    thumb_job_t* queue_tail;
+    thumb_job_t* done;       // finished, waiting for the UI thread
+    uint generation;         // bumped by cancel, older results are dropped
+    bool stopping;
+    char cache_dir[PATH_MAX]; // empty when no cache directory is usable
+} thumb_pool_t;
+
+bool thumb_pool_start(thumb_pool_t* pool);
+void thumb_pool_stop(thumb_pool_t* pool);
+
+void thumb_pool_request(thumb_pool_t* pool, const char* path, long mtime, long size, int index);
+void thumb_pool_cancel(thumb_pool_t* pool);
+thumb_job_t* thumb_pool_collect(thumb_pool_t* pool);
+void thumb_job_free(thumb_job_t* job);
+
+ppm_image_t* thumb_generate(const char* path);
+
+#endif // PRISM_THUMBS_H
@@ -0,0 +1,35 @@
+#ifndef PRISM_TEST_H
+#define PRISM_TEST_H
+
+#include "utils.h"
+
+// Failed expectations are counted, a test's main returns test_result()
+static int TEST_FAILURES = 0;
+
+#define expect(c, msg, ...) do { \
+    if(!(c)) { \
+        _error("%s:%d: " msg, __FILE__, __LINE__, ##__VA_ARGS__); \
+        TEST_FAILURES++; \
+    } \
+} while(0)
+
+static inline int test_result(const char* name) {
+    if(TEST_FAILURES) {
+        fprintf(stderr, "%s: %d failed\n", name, TEST_FAILURES);
+        return 1;
+    }
+    fprintf(stderr, "%s: ok\n", name);
+    return 0;
+}
+
+// xorshift64, seeded per test so failures reproduce
+static inline uint test_rand(ulong* state) {
+    ulong x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return (uint)(x >> 32);
+}
+
+#endif // PRISM_TEST_H
@@ -0,0 +1,97 @@
+// math.h must come before utils.h, which defines a log() macro
+#include <math.h>
+
+#include "test.h"
+#include "brush.h"
+
+#include <string.h>
+
+#define SPAN_MAX 67
+
+// Unrounded blend, the integer paths may differ from it by one step
+static double blend_reference(uint s, uint d, uint cov, blend_mode_t mode) {
+    double t;
+    switch(mode) {
+        case BLEND_MULTIPLY: t = s * d / 255.0; break;
+        case BLEND_SCREEN: t = s + d - s * d / 255.0; break;
+        default: t = s; break;
+    }
+    return (t * cov + d * (255.0 - cov)) / 255.0;
+}
+
+static void random_span(ulong* seed, Color* dst, unsigned char* coverage, int n) {
+    for(int i = 0; i < n; i++) {
+        uint v = test_rand(seed);
+        dst[i] = (Color){ v, v >> 8, v >> 16, 255 };
+
+        // Runs of zero and full coverage as well as partial, like a real mask
+        uint pick = test_rand(seed) % 4;
+        coverage[i] = pick == 0 ? 0 : (pick == 1 ? 255 : test_rand(seed) & 0xff);
+    }
+}
+
+// Whole spans go through the vector loop, single pixels through the scalar tail
+static void test_blend_span(void) {
+    ulong seed = 0x9e3779b97f4a7c15UL;
+    Color dst[SPAN_MAX];
+    Color single[SPAN_MAX];
+    Color before[SPAN_MAX];
+    unsigned char coverage[SPAN_MAX];
+
+    for(int mode = 0; mode < BLEND_MODE_COUNT; mode++) {
+        for(int round = 0; round < 2000; round++) {
+            int n = round % SPAN_MAX;
+            uint v = test_rand(&seed);
+            Color color = { v, v >> 8, v >> 16, 255 };
+            random_span(&seed, before, coverage, n);
+            memcpy(dst, before, sizeof(Color) * n);
+            memcpy(single, before, sizeof(Color) * n);
+
+            blend_span(dst, coverage, n, color, mode);
+            for(int i = 0; i < n; i++) {
+                blend_span(single + i, coverage + i, 1, color, mode);
+            }
+
+            for(int i = 0; i < n; i++) {
+                expect(memcmp(&dst[i], &single[i], sizeof(Color)) == 0,
+                    "%s span of %d differs from scalar at %d", blend_mode_name(mode), n, i);
+
+                const unsigned char* s = &color.r;
+                const unsigned char* d = &before[i].r;
+                const unsigned char* out = &dst[i].r;
+                for(int ch = 0; ch < 3; ch++) {
+                    double ref = blend_reference(s[ch], d[ch], coverage[i], mode);
+                    expect(fabs(out[ch] - ref) <= 1.0, "%s channel %d: %u, expected %.2f",
+                        blend_mode_name(mode), ch, out[ch], ref);
+                }
+            }
+        }
+    }
+}
+
+// A fully hard brush keeps the dx^2 + dy^2 <= r^2 footprint
+static void test_hard_footprint(void) {
+    ppm_image_t* img = create_ppm_image(32, 32, 255);
+    brush_t brush;
+    brush_init(&brush, 5);
+
+    brush_stamp(img, &brush, 16, 16, BLACK);
+    int covered = 0;
+    for(ulong i = 0; i < 32 * 32; i++) {
+        covered += img->pixels[i].r == 0;
+    }
+    expect(covered == 81, "hard radius 5 brush covered %d pixels, expected 81", covered);
+
+    // Clipped at a corner, only the quarter inside the image changes
+    brush_stamp(img, &brush, 0, 0, BLACK);
+    expect(img->pixels[0].r == 0 && img->pixels[5].r == 0 && img->pixels[6].r == 255, "corner stamp misclipped");
+
+    brush_free(&brush);
+    free_ppm_image(img);
+}
+
+int main(void) {
+    test_blend_span();
+    test_hard_footprint();
+    return test_result("brush");
+}
@@ -0,0 +1,139 @@
+// math.h must come before utils.h, which defines a log() macro
+#include <math.h>
+
+#include "test.h"
+#include "compare.h"
+
+#include <string.h>
+
+// Plain per-pixel difference the vectorized row kernels must agree with
+typedef struct oracle {
+    ulong changed_pixels;
+    ulong sum_sq;
+    uint max_error;
+} oracle_t;
+
+static uint pixel_error(Color a, Color b, ulong* sum_sq) {
+    int d[3] = { abs((int)a.r - b.r), abs((int)a.g - b.g), abs((int)a.b - b.b) };
+    uint m = 0;
+    for(int ch = 0; ch < 3; ch++) {
+        *sum_sq += (ulong)(d[ch] * d[ch]);
+        if((uint)d[ch] > m) m = d[ch];
+    }
+    return m;
+}
+
+// b is a with some pixels nudged, by small steps and by whole-range jumps
+static void random_pair(ulong* seed, ppm_image_t* a, ppm_image_t* b) {
+    ulong n = (ulong)a->width * a->height;
+    for(ulong i = 0; i < n; i++) {
+        uint v = test_rand(seed);
+        a->pixels[i] = (Color){ v, v >> 8, v >> 16, 255 };
+        b->pixels[i] = a->pixels[i];
+
+        uint pick = test_rand(seed) % 8;
+        if(pick == 0) {
+            b->pixels[i].g ^= test_rand(seed) & 0x07;
+        } else if(pick == 1) {
+            uint w = test_rand(seed);
+            b->pixels[i] = (Color){ w, w >> 8, w >> 16, 255 };
+        }
+    }
+
+    // Alpha isn't part of a PPM, differences there must not count
+    b->pixels[n / 2].a = 0;
+}
+
+static void check_against_oracle(const compare_t* c, const ppm_image_t* a, const ppm_image_t* b, bool heatmap) {
+    oracle_t o = { 0 };
+    for(uint y = 0; y < a->height; y++) {
+        for(uint x = 0; x < a->width; x++) {
+            ulong i = (ulong)y * a->width + x;
+            uint e = pixel_error(a->pixels[i], b->pixels[i], &o.sum_sq);
+            if(e > o.max_error) o.max_error = e;
+            if(e <= c->tolerance) continue;
+            o.changed_pixels++;
+
+            // Every changed pixel lies in its tile's bounds and in some region
+            rect_t t = c->tile_bounds[(y / COMPARE_TILE) * c->tiles_x + x / COMPARE_TILE];
+            expect((int)x >= t.x && (int)x < t.x + t.width && (int)y >= t.y && (int)y < t.y + t.height,
+                "pixel %u,%u outside its tile bounds", x, y);
+            bool in_region = false;
+            for(int r = 0; r < c->region_count && !in_region; r++) {
+                rect_t g = c->regions[r];
+                in_region = (int)x >= g.x && (int)x < g.x + g.width && (int)y >= g.y && (int)y < g.y + g.height;
+            }
+            expect(in_region, "pixel %u,%u outside every region", x, y);
+        }
+    }
+
+    if(heatmap) {
+        for(ulong i = 0; i < (ulong)a->width * a->height; i++) {
+            ulong unused = 0;
+            Color h = heatmap_color((unsigned char)pixel_error(a->pixels[i], b->pixels[i], &unused));
+            if(memcmp(&h, &c->heatmap->pixels[i], sizeof(Color)) != 0) {
+                expect(false, "heatmap differs at pixel %lu", i);
+                break;
+            }
+        }
+    }
+
+    expect(c->changed_pixels == o.changed_pixels, "%ux%u tol %u: %lu changed, expected %lu",
+        a->width, a->height, c->tolerance, c->changed_pixels, o.changed_pixels);
+    expect(c->sum_sq == o.sum_sq, "%ux%u: sum_sq %lu, expected %lu", a->width, a->height, c->sum_sq, o.sum_sq);
+    expect(c->max_error == o.max_error, "%ux%u: max error %u, expected %u", a->width, a->height, c->max_error, o.max_error);
+}
+
+// Widths around the 4- and 16-pixel vector steps and the tile size, fed in
+// uneven bands the way compare_files streams them
+static void test_kernels(void) {
+    static const uint widths[] = { 1, 3, 4, 5, 15, 16, 17, 63, 64, 65, 131 };
+    static const uint tolerances[] = { 0, 3, 40, 255 };
+    ulong seed = 0x2545f4914f6cdd1dUL;
+
+    for(uint w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        uint width = widths[w];
+        uint height = 1 + test_rand(&seed) % 150;
+        ppm_image_t* a = alloc_ppm_image(width, height, 255);
+        ppm_image_t* b = alloc_ppm_image(width, height, 255);
+        random_pair(&seed, a, b);
+
+        for(uint t = 0; t < sizeof(tolerances) / sizeof(tolerances[0]); t++) {
+            compare_t c;
+            expect(compare_begin(&c, width, height, tolerances[t], 0), "compare_begin failed");
+            for(uint y = 0; y < height;) {
+                uint count = 1 + test_rand(&seed) % 40;
+                if(count > height - y) count = height - y;
+                compare_rows(&c, a->pixels + (ulong)y * width, b->pixels + (ulong)y * width, y, count);
+                y += count;
+            }
+            compare_finish(&c);
+            check_against_oracle(&c, a, b, false);
+            compare_free(&c);
+        }
+
+        compare_t c;
+        expect(compare_images(&c, a, b, 0, true), "compare_images failed");
+        check_against_oracle(&c, a, b, true);
+        compare_free(&c);
+
+        free_ppm_image(a);
+        free_ppm_image(b);
+    }
+}
+
+static void test_identical(void) {
+    ppm_image_t* a = create_ppm_image(37, 9, 255);
+    compare_t c;
+    expect(compare_images(&c, a, a, 0, false), "compare_images failed");
+    expect(c.changed_pixels == 0 && c.sum_sq == 0 && c.region_count == 0, "identical images differ");
+    expect(isinf(c.psnr), "identical images have PSNR %.2f", c.psnr);
+    compare_free(&c);
+    free_ppm_image(a);
+}
+
+int main(void) {
+    test_kernels();
+    test_identical();
+    return test_result("compare");
+}
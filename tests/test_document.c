@@ -0,0 +1,159 @@
+#include "test.h"
+#include "document.h"
+
+#include <string.h>
+
+// A few colors, so the images can be indexed under pressure
+static ppm_image_t* small_image(ulong* seed) {
+    ppm_image_t* img = alloc_ppm_image(64, 64, 255);
+    for(ulong i = 0; i < 64 * 64; i++) {
+        uint v = test_rand(seed) % 5;
+        img->pixels[i] = (Color){ v * 50, 255 - v * 50, v, 255 };
+    }
+    return img;
+}
+
+static int add_document(documents_t* docs, ppm_image_t* img, ulong last_used) {
+    int index = documents_add(docs);
+    docs->items[index].image = img;
+    docs->items[index].last_used = last_used;
+    return index;
+}
+
+// What the editor does before a write: a shared image is swapped for a copy
+static bool make_writable(document_t* doc) {
+    if(doc->image->refs == 1) return true;
+    ppm_image_t* copy = clone_ppm_image(doc->image);
+    if(!copy) return false;
+    free_ppm_image(doc->image);
+    doc->image = copy;
+    return true;
+}
+
+static void test_copy_on_write(void) {
+    ulong seed = 0xa0761d6478bd642fUL;
+    documents_t docs = { .active = -1, .budget = DEFAULT_MEMORY_BUDGET };
+    ppm_image_t* img = small_image(&seed);
+    ulong hash = hash_ppm_image(img);
+
+    // Keep a reference of our own to see the documents let go of theirs
+    ppm_image_t* watch = share_ppm_image(img);
+    int original = add_document(&docs, img, 1);
+    int duplicate = add_document(&docs, share_ppm_image(img), 2);
+    expect(img->refs == 3, "%u references after duplicating", img->refs);
+    expect(documents_memory(&docs) == ppm_image_bytes(img), "shared image counted %lu bytes", documents_memory(&docs));
+
+    document_t* dup = &docs.items[duplicate];
+    expect(make_writable(dup) && dup->image != img, "duplicate didn't get its own copy");
+    dup->image->pixels[0] = (Color){ 1, 2, 3, 255 };
+    expect(hash_ppm_image(docs.items[original].image) == hash, "writing the duplicate changed the original");
+    expect(img->refs == 2, "%u references after the copy", img->refs);
+    expect(make_writable(dup) && dup->image->refs == 1, "unshared image copied again");
+
+    // Closing the original keeps the active index on its document
+    docs.active = duplicate;
+    documents_remove(&docs, original);
+    expect(docs.count == 1 && docs.active == 0 && docs.items[0].image == dup->image, "remove misplaced the active document");
+    expect(img->refs == 1, "closed document kept its reference, %u left", img->refs);
+    documents_free(&docs);
+    expect(docs.count == 0 && docs.active == -1, "documents left after free");
+    free_ppm_image(watch);
+}
+
+static void test_recent(void) {
+    ulong seed = 0xe7037ed1a0b428dbUL;
+    documents_t docs = { .active = -1 };
+    for(int i = 0; i < MAX_DOCUMENTS; i++) {
+        add_document(&docs, small_image(&seed), (ulong)((i * 7) % MAX_DOCUMENTS));
+    }
+    expect(documents_add(&docs) < 0, "more than %d documents open", MAX_DOCUMENTS);
+
+    // Index 9 was used last (15), then index 2 (14)
+    docs.active = 9;
+    expect(documents_recent(&docs) == 2, "recent is %d, expected 2", documents_recent(&docs));
+    documents_remove(&docs, 2);
+    expect(docs.active == 8, "active is %d after removing an earlier tab", docs.active);
+    documents_free(&docs);
+}
+
+typedef struct trim_setup {
+    documents_t docs;
+    ppm_image_t* other; // compared against for the heatmap
+    ulong full;         // memory before trimming
+} trim_setup_t;
+
+// Active document 0, documents 1 and 2 share an image, 3 has a heatmap.
+// Parked least recently used first: 1, 2, 3
+static void trim_setup(trim_setup_t* t, ulong seed) {
+    t->docs = (documents_t){ .active = -1 };
+    documents_t* docs = &t->docs;
+    add_document(docs, small_image(&seed), 4);
+    ppm_image_t* shared = small_image(&seed);
+    add_document(docs, shared, 1);
+    add_document(docs, share_ppm_image(shared), 2);
+    add_document(docs, small_image(&seed), 3);
+    docs->active = 0;
+
+    for(int i = 0; i < docs->count; i++) {
+        stats_compute(&docs->items[i].stats, docs->items[i].image);
+    }
+    t->other = small_image(&seed);
+    compare_images(&docs->items[3].compare, docs->items[3].image, t->other, 0, true);
+    docs->items[3].comparing = true;
+    t->full = documents_memory(docs);
+}
+
+static void trim_teardown(trim_setup_t* t) {
+    documents_free(&t->docs);
+    free_ppm_image(t->other);
+}
+
+static void expect_active_untouched(const documents_t* docs) {
+    const document_t* active = &docs->items[docs->active];
+    expect(active->stats.valid && !ppm_indexed(active->image), "trim touched the active document");
+    expect(!ppm_indexed(docs->items[1].image) && docs->items[1].image->refs == 2, "trim changed a shared image");
+}
+
+static void test_trim(void) {
+    trim_setup_t t;
+
+    // Just over budget, only the least recently used statistics go
+    trim_setup(&t, 1);
+    t.docs.budget = t.full - 1;
+    documents_trim(&t.docs);
+    expect(!t.docs.items[1].stats.valid && t.docs.items[2].stats.valid && t.docs.items[3].stats.valid,
+        "trim didn't evict least recently used first");
+    expect(documents_memory(&t.docs) <= t.docs.budget && !t.docs.over_budget, "still over a reachable budget");
+    expect_active_untouched(&t.docs);
+    trim_teardown(&t);
+
+    // Nothing fits, everything evictable goes and the rest is reported
+    trim_setup(&t, 2);
+    t.docs.budget = 1;
+    t.docs.may_index = true;
+    documents_trim(&t.docs);
+    for(int i = 1; i < 4; i++) {
+        expect(!t.docs.items[i].stats.valid, "document %d kept its statistics", i);
+    }
+    expect(!t.docs.items[3].compare.heatmap && t.docs.items[3].comparing, "heatmap kept or comparison dropped");
+    expect(ppm_indexed(t.docs.items[3].image), "unshared parked image wasn't indexed");
+    expect(t.docs.over_budget, "over budget not reported");
+    expect_active_untouched(&t.docs);
+    trim_teardown(&t);
+
+    // Palette storage is only used when the user allows it
+    trim_setup(&t, 3);
+    t.docs.budget = 1;
+    documents_trim(&t.docs);
+    for(int i = 0; i < 4; i++) {
+        expect(!ppm_indexed(t.docs.items[i].image), "document %d indexed with indexing off", i);
+    }
+    trim_teardown(&t);
+}
+
+int main(void) {
+    test_copy_on_write();
+    test_recent();
+    test_trim();
+    return test_result("document");
+}
@@ -0,0 +1,120 @@
+#include "test.h"
+#include "brush.h"
+#include "image.h"
+
+#include <string.h>
+
+// The first `colors` pixels are distinct, the rest repeat them
+static ppm_image_t* image_with_colors(ulong* seed, uint width, uint height, uint colors) {
+    ppm_image_t* img = alloc_ppm_image(width, height, 255);
+    for(ulong i = 0; i < (ulong)width * height; i++) {
+        uint c = i < colors ? (uint)i : test_rand(seed) % colors;
+        img->pixels[i] = (Color){ c * 7, c >> 5, (c >> 13) * 31, 255 };
+    }
+    return img;
+}
+
+static void test_round_trip(void) {
+    static const uint counts[] = { 1, 200, 256, 257, 3000, 65536, 65537 };
+    ulong seed = 0x61c8864680b583ebUL;
+
+    for(uint k = 0; k < sizeof(counts) / sizeof(counts[0]); k++) {
+        uint colors = counts[k];
+        ppm_image_t* img = image_with_colors(&seed, 400, 300, colors);
+        ppm_image_t* copy = clone_ppm_image(img);
+        ulong hash = hash_ppm_image(img);
+
+        bool indexed = ppm_image_index(img);
+        expect(indexed == (colors <= PALETTE_MAX_COLORS), "%u colors: indexed %d", colors, indexed);
+        if(indexed) {
+            expect(img->palette_size == colors, "%u colors: palette of %u", colors, img->palette_size);
+            expect((img->index8 != NULL) == (colors <= 256), "%u colors: wrong index width", colors);
+            // 16-bit indices carry a full-size palette, only pay off on large images
+            if(img->index8) expect(ppm_image_bytes(img) < ppm_image_bytes(copy), "%u colors: indexed storage isn't smaller", colors);
+        }
+        expect(hash_ppm_image(img) == hash, "%u colors: hash changed by indexing", colors);
+
+        expect(ppm_image_expand(img) && !ppm_indexed(img), "%u colors: expand failed", colors);
+        expect(memcmp(img->pixels, copy->pixels, sizeof(Color) * img->width * img->height) == 0,
+            "%u colors: pixels changed by the round trip", colors);
+
+        free_ppm_image(copy);
+        free_ppm_image(img);
+    }
+}
+
+// The same edits on palette and direct storage must give the same image
+static void test_edits_match(void) {
+    ulong seed = 0xe7037ed1a0b428dbUL;
+    ppm_image_t* direct = image_with_colors(&seed, 257, 131, 40);
+    ppm_image_t* indexed = clone_ppm_image(direct);
+    expect(ppm_image_index(indexed), "indexing failed");
+
+    brush_t brush;
+    brush_init(&brush, 6);
+    for(int k = 0; k < 200; k++) {
+        uint v = test_rand(&seed);
+        Color color = { (v % 5) * 60, ((v >> 8) % 3) * 100, 0, 255 };
+        int x = (int)(test_rand(&seed) % 280) - 10;
+        int y = (int)(test_rand(&seed) % 150) - 10;
+
+        if(k % 3 == 0) {
+            brush_stamp(direct, &brush, x, y, color);
+            brush_stamp(indexed, &brush, x, y, color);
+        } else if(x >= 0 && x < 257 && y >= 0 && y < 131) {
+            ulong filled_direct = 0;
+            ulong filled_indexed = 0;
+            flood_fill(direct, x, y, color, &filled_direct);
+            flood_fill(indexed, x, y, color, &filled_indexed);
+            expect(filled_direct == filled_indexed, "edit %d: filled %lu and %lu pixels", k, filled_direct, filled_indexed);
+        }
+        expect(hash_ppm_image(direct) == hash_ppm_image(indexed), "edit %d: storage modes diverged", k);
+    }
+    brush_free(&brush);
+
+    // Hard normal brushes and fills have indexed paths, nothing should have expanded
+    expect(ppm_indexed(indexed), "edits expanded the indexed image");
+
+    free_ppm_image(direct);
+    free_ppm_image(indexed);
+}
+
+// Colors no pixel uses any more are reclaimed before the indices widen
+static void test_palette_reuse(void) {
+    ppm_image_t* img = create_ppm_image(64, 64, 255);
+    expect(ppm_image_index(img) && img->index8, "blank image didn't index to 8 bits");
+
+    for(int k = 0; k < 300; k++) {
+        ulong filled = 0;
+        flood_fill(img, 0, 0, (Color){ k & 0xff, k >> 8, 1, 255 }, &filled);
+        expect(filled == 64 * 64, "recolor %d filled %lu pixels", k, filled);
+    }
+    expect(img->index8 != NULL, "recolors widened the indices");
+
+    free_ppm_image(img);
+}
+
+// The 257th color in use widens to 16-bit indices without changing a pixel
+static void test_widen(void) {
+    ulong seed = 0x3c6ef372fe94f82bUL;
+    ppm_image_t* img = image_with_colors(&seed, 32, 32, 256);
+    expect(ppm_image_index(img) && img->index8, "256 colors didn't index to 8 bits");
+    ulong hash = hash_ppm_image(img);
+
+    int index = ppm_palette_index(img, (Color){ 1, 2, 3, 255 });
+    expect(index == 256 && img->index16 && !img->index8, "new color got index %d", index);
+    expect(hash_ppm_image(img) == hash, "widening changed the image");
+    for(uint i = 0; i < 256; i++) {
+        expect(ppm_palette_index(img, ppm_pixel(img, i)) == (int)ppm_index_at(img, i), "pixel %u lost its palette entry", i);
+    }
+
+    free_ppm_image(img);
+}
+
+int main(void) {
+    test_round_trip();
+    test_edits_match();
+    test_palette_reuse();
+    test_widen();
+    return test_result("image");
+}
@@ -0,0 +1,172 @@
+#include "test.h"
+#include "replay.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define FRAMES 500
+
+static char dir[] = "/tmp/prism_test_XXXXXX";
+
+// Mostly idle frames with bursts of input, the way a session looks
+static input_t random_input(ulong* seed, const input_t* last) {
+    input_t in = *last;
+    uint pick = test_rand(seed) % 8;
+    if(pick == 0) {
+        in.width = 640 + test_rand(seed) % 640;
+        in.height = 480 + test_rand(seed) % 480;
+    } else if(pick <= 3) {
+        in.mouse = (Vector2){ (float)(test_rand(seed) % 100000) / 64.0f, (float)(test_rand(seed) % 100000) / 64.0f };
+        in.buttons_down = test_rand(seed) & 7;
+        in.buttons_pressed = in.buttons_down & ~last->buttons_down;
+        in.buttons_released = last->buttons_down & ~in.buttons_down;
+    } else if(pick == 4) {
+        in.wheel = (float)((int)(test_rand(seed) % 7) - 3);
+        in.keys_down = test_rand(seed) & 0xff;
+        in.keys_pressed = in.keys_down & ~last->keys_down;
+    }
+    return in;
+}
+
+static action_t random_action(ulong* seed, uint count) {
+    action_t action = { 0 };
+    action.type = test_rand(seed) % count;
+    for(int i = 0; i < 3; i++) {
+        action.args[i] = (int)test_rand(seed);
+    }
+    action.value = (float)test_rand(seed) / 4096.0f;
+    if(test_rand(seed) & 1) snprintf(action.path, sizeof(action.path), "/images/%08x.ppm", test_rand(seed));
+    return action;
+}
+
+static bool inputs_equal(const input_t* a, const input_t* b) {
+    return a->width == b->width && a->height == b->height && a->mouse.x == b->mouse.x && a->mouse.y == b->mouse.y
+        && a->wheel == b->wheel && a->buttons_down == b->buttons_down && a->buttons_pressed == b->buttons_pressed
+        && a->buttons_released == b->buttons_released && a->keys_down == b->keys_down && a->keys_pressed == b->keys_pressed;
+}
+
+static bool actions_equal(const action_t* a, const action_t* b) {
+    return a->type == b->type && memcmp(a->args, b->args, sizeof(a->args)) == 0 && a->value == b->value
+        && strcmp(a->path, b->path) == 0;
+}
+
+// Writes a session, then checks every frame and action reads back unchanged
+static void test_round_trip(const char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    ulong seed = 0xbf58476d1ce4e5b9UL;
+    recorder_t rec;
+    expect(recorder_open(&rec, path), "recorder_open failed");
+    input_t in = { 0 };
+    for(int f = 0; f < FRAMES; f++) {
+        in = random_input(&seed, &in);
+        recorder_frame(&rec, &in);
+        int actions = test_rand(&seed) % 4 == 0 ? test_rand(&seed) % 3 + 1 : 0;
+        for(int k = 0; k < actions; k++) {
+            action_t action = random_action(&seed, ACTION_COUNT);
+            recorder_action(&rec, &action);
+        }
+    }
+    expect(recorder_close(&rec), "recorder_close failed");
+
+    // Same seed, so the expected session is generated again alongside
+    seed = 0xbf58476d1ce4e5b9UL;
+    replay_t rp;
+    expect(replay_open(&rp, path), "replay_open failed");
+    expect(rp.version == 2, "recorded version %u", rp.version);
+    input_t expected = { 0 };
+    int frames = 0;
+    while(replay_next_frame(&rp)) {
+        Vector2 previous = expected.mouse;
+        expected = random_input(&seed, &expected);
+        expect(inputs_equal(&rp.input, &expected), "frame %d input differs", frames);
+        expect(rp.input.mouse_delta.x == expected.mouse.x - previous.x && rp.input.mouse_delta.y == expected.mouse.y - previous.y,
+            "frame %d mouse delta differs", frames);
+
+        int actions = test_rand(&seed) % 4 == 0 ? test_rand(&seed) % 3 + 1 : 0;
+        expect(rp.action_count == actions, "frame %d has %d actions, expected %d", frames, rp.action_count, actions);
+        for(int k = 0; k < actions && k < rp.action_count; k++) {
+            action_t action = random_action(&seed, ACTION_COUNT);
+            expect(actions_equal(&rp.actions[k], &action), "frame %d action %d differs", frames, k);
+        }
+        frames++;
+    }
+    expect(frames == FRAMES && !rp.corrupt, "replayed %d of %d frames", frames, FRAMES);
+    replay_close(&rp);
+    unlink(path);
+}
+
+static void write_bytes(const char* path, const unsigned char* data, size_t size) {
+    FILE* f = fopen(path, "wb");
+    fwrite(data, 1, size, f);
+    fclose(f);
+}
+
+static size_t read_bytes(const char* path, unsigned char* data, size_t size) {
+    FILE* f = fopen(path, "rb");
+    size_t n = fread(data, 1, size, f);
+    fclose(f);
+    return n;
+}
+
+// Version 1 files still replay, but can't contain the actions added for tabs
+static void test_versions(void) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/versions.rec", dir);
+
+    recorder_t rec;
+    expect(recorder_open(&rec, path), "recorder_open failed");
+    input_t in = { .width = 800, .height = 600 };
+    recorder_frame(&rec, &in);
+    action_t open = { .type = ACTION_OPEN, .path = "a.ppm" };
+    recorder_action(&rec, &open);
+    recorder_frame(&rec, &in);
+    action_t tab = { .type = ACTION_SWITCH_TAB, .args = { 1 } };
+    recorder_action(&rec, &tab);
+    recorder_close(&rec);
+
+    unsigned char data[4096];
+    size_t size = read_bytes(path, data, sizeof(data));
+
+    // The magic is ASCII text, so the first byte equal to 2 is the version after it
+    size_t version_at = 0;
+    while(version_at < size && data[version_at] != 2) version_at++;
+    expect(version_at < size, "no version byte found");
+
+    data[version_at] = 1;
+    write_bytes(path, data, size);
+    replay_t rp;
+    expect(replay_open(&rp, path) && rp.version == 1, "version 1 recording rejected");
+    expect(replay_next_frame(&rp) && rp.action_count == 1 && rp.actions[0].type == ACTION_OPEN, "version 1 frame misread");
+    expect(!replay_next_frame(&rp) && rp.corrupt, "tab action accepted in a version 1 recording");
+    replay_close(&rp);
+
+    data[version_at] = 3;
+    write_bytes(path, data, size);
+    expect(!replay_open(&rp, path), "version 3 recording accepted");
+
+    // Cut inside the last action
+    data[version_at] = 2;
+    write_bytes(path, data, size - 3);
+    expect(replay_open(&rp, path), "replay_open failed");
+    expect(replay_next_frame(&rp), "first frame lost");
+    expect(!replay_next_frame(&rp) && rp.corrupt, "truncated recording not reported");
+    replay_close(&rp);
+
+    unlink(path);
+}
+
+int main(void) {
+    if(!mkdtemp(dir)) {
+        error("Unable to create a temporary directory");
+        return 1;
+    }
+
+    test_round_trip("session.rec");
+    test_round_trip("session.rec.gz");
+    test_versions();
+
+    rmdir(dir);
+    return test_result("replay");
+}
@@ -0,0 +1,167 @@
+#include "test.h"
+#include "selection.h"
+
+#include <string.h>
+
+// Every pixel distinct, so a misplaced pixel can't match by accident
+static ppm_image_t* numbered_image(uint width, uint height) {
+    ppm_image_t* img = alloc_ppm_image(width, height, 255);
+    for(uint i = 0; i < width * height; i++) {
+        img->pixels[i] = (Color){ i & 0xff, (i >> 8) & 0xff, (i >> 16) & 0xff, 255 };
+    }
+    return img;
+}
+
+static Color at(const ppm_image_t* img, uint x, uint y) {
+    return img->pixels[(ulong)y * img->width + x];
+}
+
+static bool same(Color a, Color b) {
+    return memcmp(&a, &b, sizeof(Color)) == 0;
+}
+
+// Sizes around the rotation tile, none of them multiples of it
+static const uint sizes[][2] = {
+    { 33, 70 }, { 70, 33 }, { 1, 1 }, { 1, ROTATE_TILE + 3 }, { ROTATE_TILE * 2 + 5, ROTATE_TILE - 1 }, { 97, 131 },
+};
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+static void test_rotate(void) {
+    for(uint k = 0; k < SIZE_COUNT; k++) {
+        uint w = sizes[k][0];
+        uint h = sizes[k][1];
+        ppm_image_t* img = numbered_image(w, h);
+
+        ppm_image_t* cw = rotate_image_90(img, true);
+        ppm_image_t* ccw = rotate_image_90(img, false);
+        expect(cw->width == h && cw->height == w && ccw->width == h && ccw->height == w, "%ux%u: rotated size wrong", w, h);
+
+        int errors = 0;
+        for(uint y = 0; y < h && errors < 5; y++) {
+            for(uint x = 0; x < w && errors < 5; x++) {
+                Color c = at(img, x, y);
+                if(!same(at(cw, h - 1 - y, x), c)) {
+                    expect(false, "%ux%u: clockwise misplaced %u,%u", w, h, x, y);
+                    errors++;
+                }
+                if(!same(at(ccw, y, w - 1 - x), c)) {
+                    expect(false, "%ux%u: counter-clockwise misplaced %u,%u", w, h, x, y);
+                    errors++;
+                }
+            }
+        }
+
+        free_ppm_image(cw);
+        free_ppm_image(ccw);
+        free_ppm_image(img);
+    }
+}
+
+// Regions that hang off every edge, clipped the same way the editor does
+static rect_t random_rect(ulong* seed, uint w, uint h) {
+    return (rect_t){
+        (int)(test_rand(seed) % (w + 10)) - 5,
+        (int)(test_rand(seed) % (h + 10)) - 5,
+        1 + test_rand(seed) % (w + 5),
+        1 + test_rand(seed) % (h + 5),
+    };
+}
+
+static bool inside(rect_t r, uint x, uint y) {
+    return (int)x >= r.x && (int)x < r.x + r.width && (int)y >= r.y && (int)y < r.y + r.height;
+}
+
+static void test_crop(void) {
+    ulong seed = 0x9fb21c651e98df25UL;
+    for(uint k = 0; k < SIZE_COUNT; k++) {
+        uint w = sizes[k][0];
+        uint h = sizes[k][1];
+        for(int round = 0; round < 20; round++) {
+            ppm_image_t* img = numbered_image(w, h);
+            ppm_image_t* reference = numbered_image(w, h);
+            rect_t r = random_rect(&seed, w, h);
+            rect_t clipped = clip_rect(r, w, h);
+
+            bool ok = crop_image(img, r);
+            expect(ok == !rect_empty(clipped), "%ux%u: crop returned %d", w, h, ok);
+            if(ok) {
+                expect(img->width == (uint)clipped.width && img->height == (uint)clipped.height, "%ux%u: cropped size wrong", w, h);
+                for(uint y = 0; y < img->height; y++) {
+                    for(uint x = 0; x < img->width; x++) {
+                        if(!same(at(img, x, y), at(reference, clipped.x + x, clipped.y + y))) {
+                            expect(false, "%ux%u: crop misplaced %u,%u", w, h, x, y);
+                            y = img->height;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            free_ppm_image(img);
+            free_ppm_image(reference);
+        }
+    }
+}
+
+static void test_regions(void) {
+    ulong seed = 0xc2b2ae3d27d4eb4fUL;
+    for(uint k = 0; k < SIZE_COUNT; k++) {
+        uint w = sizes[k][0];
+        uint h = sizes[k][1];
+        for(int round = 0; round < 20; round++) {
+            ppm_image_t* reference = numbered_image(w, h);
+            rect_t r = random_rect(&seed, w, h);
+            rect_t c = clip_rect(r, w, h);
+
+            // Copy then paste back shifted, pixels outside the paste stay put
+            ppm_image_t* copied = copy_region(reference, r);
+            expect((copied != NULL) == !rect_empty(c), "%ux%u: copy of an empty region", w, h);
+            if(copied) {
+                ppm_image_t* img = numbered_image(w, h);
+                int px = (int)(test_rand(&seed) % (w + 10)) - 5;
+                int py = (int)(test_rand(&seed) % (h + 10)) - 5;
+                paste_region(img, copied, px, py);
+                rect_t pasted = { px, py, copied->width, copied->height };
+                for(uint y = 0; y < h; y++) {
+                    for(uint x = 0; x < w; x++) {
+                        Color want = inside(pasted, x, y) ? at(reference, c.x + x - px, c.y + y - py) : at(reference, x, y);
+                        if(!same(at(img, x, y), want)) {
+                            expect(false, "%ux%u: paste wrong at %u,%u", w, h, x, y);
+                            y = h;
+                            break;
+                        }
+                    }
+                }
+                free_ppm_image(img);
+                free_ppm_image(copied);
+            }
+
+            // Flips mirror inside the clipped region only
+            ppm_image_t* hflip = numbered_image(w, h);
+            ppm_image_t* vflip = numbered_image(w, h);
+            flip_horizontal(hflip, r);
+            flip_vertical(vflip, r);
+            for(uint y = 0; y < h; y++) {
+                for(uint x = 0; x < w; x++) {
+                    bool in = inside(c, x, y);
+                    Color want_h = in ? at(reference, c.x + c.width - 1 - (x - c.x), y) : at(reference, x, y);
+                    Color want_v = in ? at(reference, x, c.y + c.height - 1 - (y - c.y)) : at(reference, x, y);
+                    expect(same(at(hflip, x, y), want_h), "%ux%u: horizontal flip wrong at %u,%u", w, h, x, y);
+                    expect(same(at(vflip, x, y), want_v), "%ux%u: vertical flip wrong at %u,%u", w, h, x, y);
+                    if(TEST_FAILURES) break;
+                }
+                if(TEST_FAILURES) break;
+            }
+            free_ppm_image(hflip);
+            free_ppm_image(vflip);
+            free_ppm_image(reference);
+        }
+    }
+}
+
+int main(void) {
+    test_rotate();
+    test_crop();
+    test_regions();
+    return test_result("selection");
+}
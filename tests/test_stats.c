@@ -0,0 +1,134 @@
+#include "test.h"
+#include "brush.h"
+#include "selection.h"
+#include "stats.h"
+
+#include <string.h>
+
+static bool stats_equal(const stats_t* a, const stats_t* b) {
+    return a->valid && b->valid && a->pixel_count == b->pixel_count && a->unique_colors == b->unique_colors
+        && memcmp(a->hist, b->hist, sizeof(a->hist)) == 0;
+}
+
+// The kept-current totals must match a full rescan of the edited image
+static void expect_current(const stats_t* stats, const ppm_image_t* img, const char* after) {
+    stats_t full = { 0 };
+    stats_compute(&full, img);
+    expect(stats_equal(stats, &full), "after %s: %lu unique colors, rescan has %lu", after, stats->unique_colors, full.unique_colors);
+    stats_free(&full);
+}
+
+static void random_image(ulong* seed, ppm_image_t* img) {
+    for(ulong i = 0; i < (ulong)img->width * img->height; i++) {
+        uint v = test_rand(seed) % 7;
+        img->pixels[i] = (Color){ v * 40, 255 - v * 30, v * v, 255 };
+    }
+}
+
+static void test_incremental(void) {
+    ulong seed = 0xd1b54a32d192ed03UL;
+    ppm_image_t* img = alloc_ppm_image(301, 203, 255);
+    random_image(&seed, img);
+
+    stats_t stats = { 0 };
+    stats_compute(&stats, img);
+    expect_current(&stats, img, "compute");
+
+    for(int k = 0; k < 20; k++) {
+        rect_t r = { (int)(test_rand(&seed) % 320) - 10, (int)(test_rand(&seed) % 220) - 10, test_rand(&seed) % 80, test_rand(&seed) % 80 };
+        Color color = { test_rand(&seed), test_rand(&seed), test_rand(&seed), 255 };
+        stats_remove_region(&stats, img, r);
+        fill_region(img, r, color);
+        stats_add_region(&stats, img, r);
+    }
+    expect_current(&stats, img, "region fills");
+
+    // Soft multiply strokes touch many colors per stamp, stats follow each stamp
+    brush_t brush;
+    brush_init(&brush, 9);
+    brush.hardness = 0.3f;
+    brush.opacity = 0.7f;
+    brush.mode = BLEND_MULTIPLY;
+    int from_x = 5;
+    int from_y = 5;
+    Color colors[] = { { 200, 10, 30, 255 }, { 0, 90, 255, 255 }, { 12, 200, 40, 255 } };
+    for(int k = 0; k < 3; k++) {
+        brush_stroke(img, &brush, &stats, &from_x, &from_y, 290 - k * 100, 190 - k * 50, colors[k]);
+    }
+    brush_free(&brush);
+    expect_current(&stats, img, "brush strokes");
+
+    Color old_color = img->pixels[0];
+    ulong filled = 0;
+    flood_fill(img, 0, 0, (Color){ 1, 2, 3, 255 }, &filled);
+    stats_replace_color(&stats, old_color, (Color){ 1, 2, 3, 255 }, filled);
+    expect_current(&stats, img, "flood fill");
+
+    stats_free(&stats);
+    free_ppm_image(img);
+}
+
+// Palette storage counts indices instead of pixels, the totals must not change
+static void test_indexed(void) {
+    ulong seed = 0x8cb92ba72f3d8dd7UL;
+    ppm_image_t* img = alloc_ppm_image(97, 61, 255);
+    random_image(&seed, img);
+
+    stats_t direct = { 0 };
+    stats_compute(&direct, img);
+    expect(ppm_image_index(img), "image with 7 colors didn't index");
+
+    stats_t indexed = { 0 };
+    stats_compute(&indexed, img);
+    expect(stats_equal(&direct, &indexed), "indexed statistics differ from direct");
+    expect(indexed.unique_colors == 7, "%lu unique colors, expected 7", indexed.unique_colors);
+
+    stats_free(&direct);
+    stats_free(&indexed);
+    free_ppm_image(img);
+}
+
+// Background computation is adopted by the poll, an edit cancels it and the
+// next poll starts over on the edited pixels
+static void test_async(void) {
+    ulong seed = 0x94d049bb133111ebUL;
+    ppm_image_t* img = alloc_ppm_image(640, 480, 255);
+    random_image(&seed, img);
+
+    stats_t stats = { 0 };
+    stats_compute_async(&stats, img);
+    expect(stats.task || stats.valid, "no computation started");
+    expect(img->refs == 1, "task holds %u references", img->refs);
+    while(!stats.valid) {
+        stats_poll(&stats, img);
+    }
+    expect(!stats.task, "task not released");
+    expect_current(&stats, img, "async compute");
+
+    stats_compute_async(&stats, img);
+    stats_cancel(&stats);
+    expect(!stats.task && !stats.valid && stats.stale, "cancel left the task running");
+    fill_region(img, (rect_t){ 10, 10, 100, 100 }, (Color){ 9, 9, 9, 255 });
+    while(!stats.valid) {
+        stats_poll(&stats, img);
+    }
+    expect(!stats.stale, "stale after the restart");
+    expect_current(&stats, img, "cancelled compute");
+
+    // Cancelling valid statistics keeps them, edits update them in place
+    stats_cancel(&stats);
+    expect(stats.valid && !stats.stale, "cancel dropped valid statistics");
+
+    stats_compute_async(&stats, img);
+    stats_free(&stats);
+    expect(!stats.task && !stats.valid && !stats.stale, "freed task left state behind");
+
+    free_ppm_image(img);
+}
+
+int main(void) {
+    test_incremental();
+    test_indexed();
+    test_async();
+    return test_result("stats");
+}
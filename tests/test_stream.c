@@ -0,0 +1,176 @@
+#include "test.h"
+#include "image.h"
+#include "stream.h"
+
+#include <string.h>
+#include <unistd.h>
+
+// Several ring blocks, so the codec thread has to wait on the caller
+#define PAYLOAD_SIZE (5 * STREAM_BLOCK_SIZE + 12345)
+
+static char dir[] = "/tmp/prism_test_XXXXXX";
+
+static void temp_path(char* path, const char* name) {
+    snprintf(path, 256, "%s/%s", dir, name);
+}
+
+// Compressible but not trivially, runs of repeated bytes among noise
+static char* make_payload(ulong seed, size_t size) {
+    char* data = make(char, size);
+    for(size_t i = 0; i < size;) {
+        uint v = test_rand(&seed);
+        size_t run = 1 + (v >> 24) % 64;
+        for(size_t k = 0; k < run && i < size; k++) {
+            data[i++] = (v & 3) ? (char)v : (char)test_rand(&seed);
+        }
+    }
+    return data;
+}
+
+static bool write_file(const char* path, const char* data, size_t size) {
+    FILE* f = stream_open_write(path);
+    if(!f) return false;
+    bool ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+// Everything the stream yields, *failed when it reported a read error
+static char* read_all(const char* path, size_t* size, bool* failed) {
+    FILE* f = stream_open_read(path);
+    if(!f) return NULL;
+
+    size_t capacity = PAYLOAD_SIZE * 2 + 1;
+    char* data = make(char, capacity);
+    *size = fread(data, 1, capacity, f);
+    *failed = ferror(f) != 0;
+    fclose(f);
+    return data;
+}
+
+static void test_round_trip(const char* name) {
+    char* payload = make_payload(0x5851f42d4c957f2dUL, PAYLOAD_SIZE);
+    char path[256];
+    temp_path(path, name);
+    expect(write_file(path, payload, PAYLOAD_SIZE), "writing %s failed", name);
+
+    size_t size = 0;
+    bool failed = false;
+    char* back = read_all(path, &size, &failed);
+    expect(back && !failed && size == PAYLOAD_SIZE && memcmp(back, payload, size) == 0,
+        "%s read back %zu of %d bytes", name, size, PAYLOAD_SIZE);
+
+    free(back);
+    free(payload);
+    unlink(path);
+}
+
+static void append_file(FILE* out, const char* path) {
+    FILE* in = fopen(path, "rb");
+    expect(in, "Unable to open %s", path);
+    if(!in) return;
+
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, n, out);
+    }
+    fclose(in);
+}
+
+// gzip allows several members back to back, readers see them as one stream
+static void test_gzip_members(void) {
+    size_t first_size = STREAM_BLOCK_SIZE + 7;
+    size_t second_size = 3 * STREAM_BLOCK_SIZE / 2;
+    char* first = make_payload(1, first_size);
+    char* second = make_payload(2, second_size);
+
+    char a[256], b[256], joined[256];
+    temp_path(a, "a.gz");
+    temp_path(b, "b.gz");
+    temp_path(joined, "ab.gz");
+    expect(write_file(a, first, first_size) && write_file(b, second, second_size), "writing members failed");
+
+    FILE* out = fopen(joined, "wb");
+    append_file(out, a);
+    append_file(out, b);
+    fclose(out);
+
+    size_t size = 0;
+    bool failed = false;
+    char* back = read_all(joined, &size, &failed);
+    expect(back && !failed && size == first_size + second_size, "joined members read %zu bytes", size);
+    expect(back && memcmp(back, first, first_size) == 0 && memcmp(back + first_size, second, second_size) == 0,
+        "joined members read back different bytes");
+
+    free(back);
+    free(first);
+    free(second);
+    unlink(a);
+    unlink(b);
+    unlink(joined);
+}
+
+// A cut-off file must fail the read instead of ending early as if complete
+static void test_truncated(const char* name) {
+    char* payload = make_payload(3, PAYLOAD_SIZE);
+    char path[256];
+    temp_path(path, name);
+    expect(write_file(path, payload, PAYLOAD_SIZE), "writing %s failed", name);
+
+    FILE* f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    long full = ftell(f);
+    fclose(f);
+    expect(truncate(path, full / 2) == 0, "truncating %s failed", name);
+
+    size_t size = 0;
+    bool failed = false;
+    char* back = read_all(path, &size, &failed);
+    expect(back && failed && size < PAYLOAD_SIZE, "truncated %s read %zu bytes without an error", name, size);
+
+    free(back);
+    free(payload);
+    unlink(path);
+}
+
+// Whole images through the PPM reader and writer on top of the streams
+static void test_images(const char* name) {
+    ppm_image_t* img = alloc_ppm_image(513, 257, 255);
+    ulong seed = 0x106689d45497fdb5UL;
+    for(ulong i = 0; i < (ulong)img->width * img->height; i++) {
+        uint v = test_rand(&seed);
+        img->pixels[i] = (Color){ v, v >> 8, (v >> 16) & 0xf0, 255 };
+    }
+
+    char path[256];
+    temp_path(path, name);
+    expect(save_ppm_image(img, path), "saving %s failed", name);
+    ppm_image_t* back = load_ppm_image(path);
+    expect(back && hash_ppm_image(back) == hash_ppm_image(img), "%s loaded back a different image", name);
+
+    free_ppm_image(back);
+    free_ppm_image(img);
+    unlink(path);
+}
+
+int main(void) {
+    if(!mkdtemp(dir)) {
+        error("Unable to create a temporary directory");
+        return 1;
+    }
+
+    test_round_trip("payload.gz");
+    test_gzip_members();
+    test_truncated("cut.gz");
+    test_images("image.ppm.gz");
+    test_images("image.ppm");
+
+#ifdef PRISM_HAVE_ZSTD
+    test_round_trip("payload.zst");
+    test_truncated("cut.zst");
+    test_images("image.ppm.zst");
+#endif
+
+    rmdir(dir);
+    return test_result("stream");
+}
@@ -0,0 +1,162 @@
+#include "test.h"
+#include "thumbs.h"
+
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static char dir[] = "/tmp/prism_test_XXXXXX";
+
+static ppm_image_t* pattern_image(uint width, uint height, uint seed) {
+    ppm_image_t* img = alloc_ppm_image(width, height, 255);
+    for(uint y = 0; y < height; y++) {
+        for(uint x = 0; x < width; x++) {
+            img->pixels[(ulong)y * width + x] = (Color){ (x * 3 + seed) & 0xff, (y * 5 + seed) & 0xff, (x ^ y) & 0xff, 255 };
+        }
+    }
+    return img;
+}
+
+// Thumbnails take every stride-th pixel of every stride-th row, from the top left
+static void expect_sampled(const ppm_image_t* thumb, const ppm_image_t* img, const char* what) {
+    uint stride_x = (img->width + THUMB_SIZE - 1) / THUMB_SIZE;
+    uint stride_y = (img->height + THUMB_SIZE - 1) / THUMB_SIZE;
+    uint stride = stride_x > stride_y ? stride_x : stride_y;
+    expect(thumb, "%s: no thumbnail", what);
+    if(!thumb) return;
+    expect(thumb->width == (img->width + stride - 1) / stride && thumb->height == (img->height + stride - 1) / stride,
+        "%s: %ux%u thumbnail", what, thumb->width, thumb->height);
+
+    for(uint y = 0; y < thumb->height && !TEST_FAILURES; y++) {
+        for(uint x = 0; x < thumb->width; x++) {
+            Color want = img->pixels[(ulong)y * stride * img->width + x * stride];
+            Color got = thumb->pixels[(ulong)y * thumb->width + x];
+            if(memcmp(&want, &got, sizeof(Color)) != 0) {
+                expect(false, "%s: thumbnail pixel %u,%u not sampled from %u,%u", what, x, y, x * stride, y * stride);
+                break;
+            }
+        }
+    }
+}
+
+static void test_generate(void) {
+    static const uint sizes[][2] = { { 300, 200 }, { 96, 96 }, { 97, 5 }, { 1, 1 }, { 50, 400 } };
+    char path[256];
+    snprintf(path, sizeof(path), "%s/sample.ppm", dir);
+
+    for(uint k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        ppm_image_t* img = pattern_image(sizes[k][0], sizes[k][1], k);
+        save_ppm_image(img, path);
+        ppm_image_t* thumb = thumb_generate(path);
+        expect_sampled(thumb, img, "generate");
+        free_ppm_image(thumb);
+        free_ppm_image(img);
+    }
+    unlink(path);
+}
+
+// Runs one request through the pool and waits for its result
+static thumb_job_t* request(thumb_pool_t* pool, const char* path) {
+    struct stat st;
+    expect(stat(path, &st) == 0, "Unable to stat %s", path);
+    thumb_pool_request(pool, path, st.st_mtime, st.st_size, 7);
+
+    for(int waited = 0; waited < 10000; waited++) {
+        thumb_job_t* job = thumb_pool_collect(pool);
+        if(job) {
+            expect(!job->next && job->index == 7, "unexpected jobs collected");
+            return job;
+        }
+        usleep(1000);
+    }
+    expect(false, "thumbnail for %s never finished", path);
+    return NULL;
+}
+
+static int cache_entries(const char* cache) {
+    DIR* d = opendir(cache);
+    if(!d) return 0;
+    int n = 0;
+    struct dirent* e;
+    while((e = readdir(d))) {
+        n += strstr(e->d_name, ".thumb") != NULL;
+    }
+    closedir(d);
+    return n;
+}
+
+static void test_cache(void) {
+    char cache_home[256], cache[300], path[256];
+    snprintf(cache_home, sizeof(cache_home), "%s/cache", dir);
+    snprintf(cache, sizeof(cache), "%s/prism/thumbs", cache_home);
+    snprintf(path, sizeof(path), "%s/cached.ppm", dir);
+    setenv("XDG_CACHE_HOME", cache_home, 1);
+
+    thumb_pool_t pool;
+    expect(thumb_pool_start(&pool) && smatch(pool.cache_dir, cache), "pool didn't use %s", cache);
+
+    ppm_image_t* img = pattern_image(250, 180, 1);
+    save_ppm_image(img, path);
+    thumb_job_t* job = request(&pool, path);
+    expect(job && job->ok && !job->cached, "first request wasn't generated");
+    if(job) expect_sampled(job->thumb, img, "first request");
+    thumb_job_free(job);
+    expect(cache_entries(cache) == 1, "%d cache entries after the first request", cache_entries(cache));
+
+    job = request(&pool, path);
+    expect(job && job->ok && job->cached, "second request missed the cache");
+    if(job) expect_sampled(job->thumb, img, "cached thumbnail");
+    thumb_job_free(job);
+
+    // Touching the file keeps its size, the mtime alone must reject the entry
+    struct timeval later[2] = { { time(NULL) + 100, 0 }, { time(NULL) + 100, 0 } };
+    utimes(path, later);
+    job = request(&pool, path);
+    expect(job && job->ok && !job->cached, "cache entry served after the mtime changed");
+    thumb_job_free(job);
+
+    // A changed file has another size, its cache entry must not be served either
+    ppm_image_t* edited = pattern_image(250, 180, 99);
+    save_ppm_image(edited, path);
+    later[0].tv_sec = later[1].tv_sec = time(NULL) + 200;
+    utimes(path, later);
+    job = request(&pool, path);
+    expect(job && job->ok && !job->cached, "stale cache entry served for a changed file");
+    if(job) expect_sampled(job->thumb, edited, "changed file");
+    thumb_job_free(job);
+    expect(cache_entries(cache) == 1, "%d cache entries after the change, expected the entry replaced", cache_entries(cache));
+
+    thumb_pool_stop(&pool);
+    free_ppm_image(img);
+    free_ppm_image(edited);
+
+    // Leave the temporary directory empty again
+    unlink(path);
+    DIR* d = opendir(cache);
+    struct dirent* e;
+    while(d && (e = readdir(d))) {
+        char file[600];
+        snprintf(file, sizeof(file), "%s/%s", cache, e->d_name);
+        if(e->d_name[0] != '.') unlink(file);
+    }
+    if(d) closedir(d);
+    rmdir(cache);
+    snprintf(cache, sizeof(cache), "%s/prism", cache_home);
+    rmdir(cache);
+    rmdir(cache_home);
+}
+
+int main(void) {
+    if(!mkdtemp(dir)) {
+        error("Unable to create a temporary directory");
+        return 1;
+    }
+
+    test_generate();
+    test_cache();
+
+    rmdir(dir);
+    return test_result("thumbs");
+}